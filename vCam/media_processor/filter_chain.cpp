@@ -0,0 +1,299 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+
+#include "filter_chain.h"  // NOLINT(build/include_subdir)
+
+#include <algorithm>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace {
+
+// Rows per slice of the fused pass: a 1080p slice of 16 rows is ~90 KB and
+// stays in L2 between the LUT and the key.
+const int kSliceRows = 16;
+
+// Greenness is g - max(r, b). Below kKeyLow a pixel is foreground, above
+// kKeyHigh it is replaced by the background, in between the two are blended
+// for a soft edge.
+const int kKeyLow = 30;
+const int kKeyHigh = 90;
+
+// Timed runs per filter in the benchmark, after one warm-up run.
+const int kBenchmarkRuns = 200;
+
+using microseconds = std::chrono::duration<double, std::micro>;
+using milliseconds = std::chrono::duration<double, std::milli>;
+
+// Blend a row of BGR foreground pixels with the background by greenness.
+// alpha = min(greenness - kKeyLow, range) * (255 * 256 / range) >> 8 and
+// out = (fg * (255 - alpha) + bg * alpha) / 255, all in 16 bit lanes.
+void chroma_key_row(uchar* fg, const uchar* bg, int width) {
+	const int range = kKeyHigh - kKeyLow;
+	const int scale = (255 << 8) / range;
+	int x = 0;
+
+#if CV_SIMD
+	const int lanes = cv::VTraits<cv::v_uint8>::vlanes();
+	const cv::v_uint8 v_low = cv::vx_setall_u8(kKeyLow);
+	const cv::v_uint16 v_range = cv::vx_setall_u16(range);
+	const cv::v_uint16 v_scale = cv::vx_setall_u16(scale);
+	const cv::v_uint16 v_255 = cv::vx_setall_u16(255);
+	const cv::v_uint16 v_128 = cv::vx_setall_u16(128);
+
+	for (; x <= width - lanes; x += lanes) {
+		cv::v_uint8 f_b, f_g, f_r, k_b, k_g, k_r;
+		cv::v_load_deinterleave(fg + x * 3, f_b, f_g, f_r);
+		cv::v_load_deinterleave(bg + x * 3, k_b, k_g, k_r);
+
+		// Saturating 8 bit arithmetic clamps non-green pixels to 0.
+		cv::v_uint8 greenness = (f_g - cv::v_max(f_r, f_b)) - v_low;
+		cv::v_uint16 a_lo, a_hi;
+		cv::v_expand(greenness, a_lo, a_hi);
+		a_lo = cv::v_shr<8>(cv::v_mul_wrap(cv::v_min(a_lo, v_range), v_scale));
+		a_hi = cv::v_shr<8>(cv::v_mul_wrap(cv::v_min(a_hi, v_range), v_scale));
+		cv::v_uint16 inv_lo = v_255 - a_lo;
+		cv::v_uint16 inv_hi = v_255 - a_hi;
+
+		auto blend = [&](const cv::v_uint8& f, const cv::v_uint8& k) {
+			cv::v_uint16 f_lo, f_hi, k_lo, k_hi;
+			cv::v_expand(f, f_lo, f_hi);
+			cv::v_expand(k, k_lo, k_hi);
+			cv::v_uint16 lo = cv::v_mul_wrap(f_lo, inv_lo) +
+				cv::v_mul_wrap(k_lo, a_lo) + v_128;
+			cv::v_uint16 hi = cv::v_mul_wrap(f_hi, inv_hi) +
+				cv::v_mul_wrap(k_hi, a_hi) + v_128;
+			// Exact division by 255 of the rounded sum
+			lo = cv::v_shr<8>(lo + cv::v_shr<8>(lo));
+			hi = cv::v_shr<8>(hi + cv::v_shr<8>(hi));
+			return cv::v_pack(lo, hi);
+		};
+
+		cv::v_store_interleave(fg + x * 3,
+		                       blend(f_b, k_b), blend(f_g, k_g), blend(f_r, k_r));
+	}
+	cv::vx_cleanup();
+#endif
+
+	for (; x < width; ++x) {
+		uchar* f = fg + x * 3;
+		const uchar* k = bg + x * 3;
+		int greenness = f[1] - (std::max)(f[0], f[2]) - kKeyLow;
+		int alpha = (std::min)((std::max)(greenness, 0), range) * scale >> 8;
+		for (int c = 0; c < 3; ++c) {
+			int sum = f[c] * (255 - alpha) + k[c] * alpha + 128;
+			f[c] = static_cast<uchar>((sum + (sum >> 8)) >> 8);
+		}
+	}
+}
+
+}  // namespace
+
+void FilterChain::Timing::record(double us) {
+	frames++;
+	total_us += us;
+	max_us = (std::max)(max_us, us);
+}
+
+void FilterChain::Timing::print(const char* name) const {
+	if (frames == 0)
+		return;
+	std::cout << name << "avg " << total_us / frames << " / max " << max_us
+	          << std::endl;
+}
+
+bool FilterChain::init(const MediaOptions& options) {
+	// Gamma, contrast (around mid grey) and brightness fused into one table
+	if (options.brightness != 0.0 || options.contrast != 1.0 ||
+		options.gamma != 1.0) {
+		lut_ = cv::Mat(1, 256, CV_8U);
+		for (int i = 0; i < 256; ++i) {
+			double value = 255.0 * std::pow(i / 255.0, 1.0 / options.gamma);
+			value = (value - 128.0) * options.contrast + 128.0 +
+				options.brightness;
+			lut_.at<uchar>(0, i) = cv::saturate_cast<uchar>(value);
+		}
+		has_lut_ = true;
+	}
+
+	if (!options.chroma_key_background.empty()) {
+		background_source_ = cv::imread(options.chroma_key_background,
+		                                cv::IMREAD_COLOR);
+		if (background_source_.empty()) {
+			std::cerr << "Failed to load chroma key background: "
+			          << options.chroma_key_background << std::endl;
+			return false;
+		}
+		has_key_ = true;
+	}
+
+	if (options.blur_region.area() > 0) {
+		blur_region_ = options.blur_region;
+		blur_kernel_ = (std::max)(options.blur_kernel, 3) | 1;
+		has_blur_ = true;
+	}
+
+	return true;
+}
+
+void FilterChain::apply(cv::Mat& frame) {  // NOLINT(runtime/references)
+	if (frame.type() != CV_8UC3)
+		return;
+
+	if (has_lut_ || has_key_) {
+		auto start = std::chrono::steady_clock::now();
+		apply_pixel_pass(frame);
+		pixel_timing_.record(
+			microseconds(std::chrono::steady_clock::now() - start).count());
+	}
+
+	if (has_blur_) {
+		auto start = std::chrono::steady_clock::now();
+		cv::Rect roi = blur_region_ & cv::Rect(0, 0, frame.cols, frame.rows);
+		if (roi.area() > 0) {
+			cv::Mat region = frame(roi);
+			cv::blur(region, region, cv::Size(blur_kernel_, blur_kernel_),
+			         cv::Point(-1, -1), cv::BORDER_REPLICATE);
+		}
+		blur_timing_.record(
+			microseconds(std::chrono::steady_clock::now() - start).count());
+	}
+}
+
+void FilterChain::apply_pixel_pass(cv::Mat& frame) {  // NOLINT
+	if (has_key_ && background_.size() != frame.size())
+		cv::resize(background_source_, background_, frame.size(), 0, 0,
+		           cv::INTER_AREA);
+
+	int slices = (frame.rows + kSliceRows - 1) / kSliceRows;
+	cv::parallel_for_(cv::Range(0, slices), [&](const cv::Range& range) {
+		int begin = range.start * kSliceRows;
+		int end = (std::min)(range.end * kSliceRows, frame.rows);
+		for (int y = begin; y < end; y += kSliceRows) {
+			int rows = (std::min)(kSliceRows, end - y);
+			if (has_lut_) {
+				cv::Mat slice = frame.rowRange(y, y + rows);
+				cv::LUT(slice, lut_, slice);
+			}
+			if (has_key_) {
+				for (int row = y; row < y + rows; ++row)
+					chroma_key_row(frame.ptr<uchar>(row),
+					               background_.ptr<uchar>(row), frame.cols);
+			}
+		}
+	});
+}
+
+void FilterChain::print_report() const {
+	if (pixel_timing_.frames == 0 && blur_timing_.frames == 0)
+		return;
+
+	std::cout << std::endl << "Filters:" << std::endl;
+	if (has_lut_ && has_key_)
+		pixel_timing_.print("Color + key pass (us):  ");
+	else if (has_key_)
+		pixel_timing_.print("Chroma key (us):        ");
+	else
+		pixel_timing_.print("Color (us):             ");
+	blur_timing_.print("Blur (us):             ");
+}
+
+bool run_filter_benchmark(const MediaOptions& options, cv::Size size) {
+	// Random texture with a green screen over the left half, so the key
+	// blends a real edge instead of taking one branch everywhere.
+	cv::Mat source(size, CV_8UC3);
+	cv::randu(source, cv::Scalar::all(0), cv::Scalar::all(256));
+	cv::randu(source(cv::Rect(0, 0, size.width / 2, size.height)),
+	          cv::Scalar(0, 120, 0), cv::Scalar(80, 256, 80));
+
+	// Settings from the command line, defaults for the filters not given.
+	MediaOptions color;
+	color.brightness = options.brightness;
+	color.contrast = options.contrast;
+	color.gamma = options.gamma;
+	if (color.brightness == 0.0 && color.contrast == 1.0 && color.gamma == 1.0)
+		color.gamma = 1.2;
+	cv::Mat background;
+	if (!options.chroma_key_background.empty()) {
+		background = cv::imread(options.chroma_key_background,
+		                        cv::IMREAD_COLOR);
+		if (background.empty()) {
+			std::cerr << "Failed to load chroma key background: "
+			          << options.chroma_key_background << std::endl;
+			return false;
+		}
+	} else {
+		background.create(size, CV_8UC3);
+		cv::randu(background, cv::Scalar::all(0), cv::Scalar::all(256));
+	}
+	cv::Rect blur_region = options.blur_region.area() > 0 ?
+		options.blur_region :
+		cv::Rect(size.width / 2 - 160, size.height / 2 - 120, 320, 240);
+
+	struct Case {
+		const char* name;
+		bool        lut;
+		bool        key;
+		bool        blur;
+	};
+	const Case cases[] = {
+		{"Color",       true,  false, false},
+		{"Chroma key",  false, true,  false},
+		{"Color + key", true,  true,  false},
+		{"Blur",        false, false, true},
+	};
+
+	std::cout << "Filter benchmark: " << size.width << "x" << size.height
+	          << " BGR frame, " << kBenchmarkRuns << " runs per filter."
+	          << std::endl;
+	std::cout << "Filter        Avg (ms)   Max (ms)   % of 30 fps"
+	          << "   % of 60 fps" << std::endl;
+
+	cv::Mat frame;
+	for (const Case& test : cases) {
+		FilterChain chain;
+		if (test.lut)
+			chain.init(color);
+		if (test.key) {
+			chain.background_source_ = background;
+			chain.has_key_ = true;
+		}
+		if (test.blur) {
+			chain.blur_region_ = blur_region;
+			chain.blur_kernel_ = (std::max)(options.blur_kernel, 3) | 1;
+			chain.has_blur_ = true;
+		}
+
+		// The first run scales the key background to the frame size.
+		source.copyTo(frame);
+		chain.apply(frame);
+
+		double total_ms = 0.0, max_ms = 0.0;
+		for (int run = 0; run < kBenchmarkRuns; ++run) {
+			// The filters work in place; start every run from the source.
+			source.copyTo(frame);
+			auto start = std::chrono::steady_clock::now();
+			chain.apply(frame);
+			double ms = milliseconds(
+				std::chrono::steady_clock::now() - start).count();
+			total_ms += ms;
+			max_ms = (std::max)(max_ms, ms);
+		}
+
+		double avg_ms = total_ms / kBenchmarkRuns;
+		std::cout << std::left << std::setw(12) << test.name << std::right
+		          << std::fixed << std::setprecision(3)
+		          << std::setw(10) << avg_ms << std::setw(11) << max_ms
+		          << std::setprecision(1)
+		          << std::setw(14) << 100.0 * avg_ms / (1000.0 / 30)
+		          << std::setw(14) << 100.0 * avg_ms / (1000.0 / 60)
+		          << std::endl;
+		std::cout.unsetf(std::ios::floatfield);
+		std::cout << std::setprecision(6);
+	}
+	return true;
+}
@@ -0,0 +1,70 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+// filter_chain.h
+
+#pragma once
+
+#ifndef FILTER_CHAIN_H
+#define FILTER_CHAIN_H
+
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+#include "media_processor.h"  // NOLINT(build/include_subdir)
+
+// Per-frame effects applied by the consumer between dequeue and present.
+//
+// Brightness, contrast and gamma are folded into a single 256 entry lookup
+// table, and that table is applied in the same pass as the chroma key: the
+// frame is split into row slices that are processed in parallel, each slice
+// going through the LUT and the key while it is still in cache. The privacy
+// blur needs neighbouring rows and runs as a separate box filter on its ROI.
+class FilterChain {
+ public:
+	// Set up the filters selected in options. Returns false if one of them
+	// can't be used, e.g. the chroma key background fails to load.
+	bool init(const MediaOptions& options);
+	bool empty() const { return !has_lut_ && !has_key_ && !has_blur_; }
+
+	// Run the chain in place on a BGR frame.
+	void apply(cv::Mat& frame);  // NOLINT(runtime/references)
+
+	void print_report() const;
+
+ private:
+	friend bool run_filter_benchmark(const MediaOptions& options,
+	                                 cv::Size size);
+
+	struct Timing {
+		uint64_t frames = 0;
+		double   total_us = 0.0;
+		double   max_us = 0.0;
+
+		void record(double us);
+		void print(const char* name) const;
+	};
+
+	void apply_pixel_pass(cv::Mat& frame);  // NOLINT(runtime/references)
+
+	bool     has_lut_ = false;
+	cv::Mat  lut_;
+
+	bool     has_key_ = false;
+	cv::Mat  background_source_;
+	// Background scaled to the frame size, resized when the frame size changes.
+	cv::Mat  background_;
+
+	bool     has_blur_ = false;
+	cv::Rect blur_region_;
+	int      blur_kernel_ = 0;
+
+	Timing   pixel_timing_;
+	Timing   blur_timing_;
+};
+
+// Time each filter, with the settings in options or defaults where none are
+// given, on a synthetic BGR frame of the given size and print the cost
+// against the frame budget at 30 and 60 fps. Returns false if a filter
+// can't be set up.
+bool run_filter_benchmark(const MediaOptions& options, cv::Size size);
+
+#endif  // FILTER_CHAIN_H
@@ -0,0 +1,318 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+
+#include "frame_allocator.h"  // NOLINT(build/include_subdir)
+
+#include <windows.h>
+#include <psapi.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>  // NOLINT(build/c++11)
+
+#pragma comment(lib, "psapi.lib")
+
+namespace {
+
+const size_t kPageSize = 4096;
+
+size_t round_up(size_t value, size_t alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+double to_mb(size_t bytes) {
+	return bytes / (1024.0 * 1024.0);
+}
+
+// Large pages need SeLockMemoryPrivilege, which has to be granted to the
+// account ("Lock pages in memory") and then enabled in the process token.
+bool enable_lock_memory_privilege() {
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(),
+	                      TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+		return false;
+
+	TOKEN_PRIVILEGES privileges = {};
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool enabled =
+		LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME,
+		                     &privileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) &&
+		GetLastError() == ERROR_SUCCESS;
+	CloseHandle(token);
+	return enabled;
+}
+
+uchar* allocate_pages(size_t bytes, int numa_node, bool large_pages) {
+	DWORD type = MEM_RESERVE | MEM_COMMIT | (large_pages ? MEM_LARGE_PAGES : 0);
+	void* memory = numa_node >= 0
+		? VirtualAllocExNuma(GetCurrentProcess(), NULL, bytes, type,
+		                     PAGE_READWRITE, static_cast<DWORD>(numa_node))
+		: VirtualAlloc(NULL, bytes, type, PAGE_READWRITE);
+	return static_cast<uchar*>(memory);
+}
+
+}  // namespace
+
+FramePoolAllocator::FramePoolAllocator(size_t min_pooled_bytes,
+                                       size_t max_retained_bytes)
+	: min_pooled_bytes_(min_pooled_bytes),
+	  max_retained_bytes_(max_retained_bytes) {
+}
+
+void FramePoolAllocator::reserve(size_t bytes, int count, int numa_node) {
+	size_t slot = round_up(bytes, kPageSize);
+	size_t total = slot * count;
+	numa_node_ = numa_node >= 0 ? numa_node : numa_node_for_affinity(0);
+
+	uchar* slab = nullptr;
+	size_t large_page = GetLargePageMinimum();
+	if (large_page != 0 && enable_lock_memory_privilege()) {
+		size_t large_total = round_up(total, large_page);
+		slab = allocate_pages(large_total, numa_node_, true);
+		if (slab != nullptr) {
+			total = large_total;
+			large_pages_ = true;
+		}
+	}
+	if (slab == nullptr) {
+		slab = allocate_pages(total, numa_node_, false);
+		if (slab == nullptr) {
+			std::cerr << "Failed to preallocate the frame pool." << std::endl;
+			return;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mtx_);
+	for (size_t offset = 0; offset + slot <= total; offset += slot)
+		buffers_[slab + offset] = Buffer{slot, true};
+	slab_bytes_ += total;
+
+	// Large pages are resident as soon as they are allocated. Regular pages
+	// are faulted in off the startup path rather than while presenting the
+	// first frames; the pool is never destroyed, so the thread can run
+	// detached.
+	if (large_pages_) {
+		std::vector<uchar*>& free_list = free_lists_[slot];
+		for (size_t offset = 0; offset + slot <= total; offset += slot)
+			free_list.push_back(slab + offset);
+		return;
+	}
+	slabs_.emplace_back(slab, total);
+	pending_slots_[slot] += static_cast<int>(total / slot);
+	std::thread(&FramePoolAllocator::prefault, this, slab, slot, total)
+		.detach();
+}
+
+void FramePoolAllocator::prefault(uchar* slab, size_t slot, size_t total) {
+	auto start = std::chrono::steady_clock::now();
+	for (size_t offset = 0; offset + slot <= total; offset += slot) {
+		memset(slab + offset, 0, slot);
+		std::lock_guard<std::mutex> lock(mtx_);
+		free_lists_[slot].push_back(slab + offset);
+		pending_slots_[slot]--;
+		prefault_cond_.notify_all();
+	}
+	std::lock_guard<std::mutex> lock(mtx_);
+	prefault_ms_ += std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+bool FramePoolAllocator::lock_slab() {
+	// slabs_ only changes in reserve(). Locking faults in the pages the
+	// prefault thread hasn't reached yet, so don't hold up allocations.
+	size_t locked = 0;
+	DWORD error = 0;
+	for (const auto& slab : slabs_) {
+		if (!VirtualLock(slab.first, slab.second)) {
+			error = GetLastError();
+			break;
+		}
+		locked += slab.second;
+	}
+
+	std::lock_guard<std::mutex> lock(mtx_);
+	locked_bytes_ += locked;
+	lock_error_ = error;
+	return error == 0;
+}
+
+cv::UMatData* FramePoolAllocator::allocate(int dims, const int* sizes,
+                                           int type, void* data,
+                                           size_t* step, cv::AccessFlag flags,
+                                           cv::UMatUsageFlags usage_flags) const {
+	cv::MatAllocator* std_allocator = cv::Mat::getStdAllocator();
+	if (data != nullptr) {
+		return std_allocator->allocate(dims, sizes, type, data, step, flags,
+		                               usage_flags);
+	}
+
+	size_t total = CV_ELEM_SIZE(type);
+	for (int i = dims - 1; i >= 0; i--) {
+		if (step)
+			step[i] = total;
+		total *= sizes[i];
+	}
+
+	if (total < min_pooled_bytes_) {
+		return std_allocator->allocate(dims, sizes, type, nullptr, step, flags,
+		                               usage_flags);
+	}
+
+	// acquire() throws when the pool cannot grow; don't leak the header.
+	std::unique_ptr<cv::UMatData> u(new cv::UMatData(this));
+	u->data = u->origdata = acquire(total);
+	u->size = total;
+	return u.release();
+}
+
+bool FramePoolAllocator::allocate(cv::UMatData* data,
+                                  cv::AccessFlag /*access_flags*/,
+                                  cv::UMatUsageFlags /*usage_flags*/) const {
+	return data != nullptr;
+}
+
+void FramePoolAllocator::deallocate(cv::UMatData* u) const {
+	if (u == nullptr)
+		return;
+
+	CV_Assert(u->urefcount == 0);
+	CV_Assert(u->refcount == 0);
+	release(u->origdata);
+	u->origdata = nullptr;
+	delete u;
+}
+
+size_t FramePoolAllocator::bytes_in_use() const {
+	std::lock_guard<std::mutex> lock(mtx_);
+	return in_use_bytes_;
+}
+
+uchar* FramePoolAllocator::acquire(size_t bytes) const {
+	size_t size = round_up(bytes, kPageSize);
+	{
+		std::unique_lock<std::mutex> lock(mtx_);
+		in_use_bytes_ += size;
+		high_water_bytes_ = (std::max)(high_water_bytes_, in_use_bytes_);
+
+		// Slab buffers still being faulted in arrive within a few
+		// milliseconds; waiting for one beats growing the pool.
+		std::vector<uchar*>& free_list = free_lists_[size];
+		if (free_list.empty() && pending_slots_[size] > 0) {
+			prefault_waits_++;
+			prefault_cond_.wait(lock, [&] {
+				return !free_list.empty() || pending_slots_[size] == 0;
+			});
+		}
+		if (!free_list.empty()) {
+			uchar* data = free_list.back();
+			free_list.pop_back();
+			if (!buffers_[data].from_slab)
+				retained_bytes_ -= size;
+			hits_++;
+			return data;
+		}
+		misses_++;
+	}
+
+	// Pool exhausted or an unusual frame size: grow the pool. The buffer is
+	// kept for reuse on release, up to max_retained_bytes.
+	uchar* data = allocate_pages(size, numa_node_, false);
+	std::lock_guard<std::mutex> lock(mtx_);
+	if (data == nullptr) {
+		in_use_bytes_ -= size;
+		CV_Error(cv::Error::StsNoMem, "Failed to allocate a frame buffer");
+	}
+	buffers_[data] = Buffer{size, false};
+	return data;
+}
+
+void FramePoolAllocator::release(uchar* data) const {
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		auto it = buffers_.find(data);
+		CV_Assert(it != buffers_.end());
+
+		Buffer buffer = it->second;
+		in_use_bytes_ -= buffer.size;
+		if (buffer.from_slab ||
+			retained_bytes_ + buffer.size <= max_retained_bytes_) {
+			free_lists_[buffer.size].push_back(data);
+			if (!buffer.from_slab)
+				retained_bytes_ += buffer.size;
+			return;
+		}
+
+		buffers_.erase(it);
+		released_++;
+	}
+	VirtualFree(data, 0, MEM_RELEASE);
+}
+
+void FramePoolAllocator::print_report() const {
+	size_t working_set = 0, peak_working_set = 0;
+	get_working_set(&working_set, &peak_working_set);
+
+	std::lock_guard<std::mutex> lock(mtx_);
+	std::cout << std::endl << "Frame pool:" << std::endl;
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "Preallocated:          " << to_mb(slab_bytes_) << " MB, "
+	          << (large_pages_ ? "large pages" : "regular pages")
+	          << ", NUMA node " << numa_node_ << std::endl;
+	if (locked_bytes_ != 0 || lock_error_ != 0) {
+		std::cout << "Locked:                " << to_mb(locked_bytes_) << " MB";
+		if (lock_error_ != 0)
+			std::cout << ", VirtualLock failed, error " << lock_error_;
+		std::cout << std::endl;
+	}
+	std::cout << "Prefault:              " << prefault_ms_ << " ms, "
+	          << prefault_waits_ << " waits" << std::endl;
+	std::cout << "Hits / misses:         " << hits_ << " / " << misses_
+	          << std::endl;
+	std::cout << "In use / high water:   " << to_mb(in_use_bytes_) << " MB / "
+	          << to_mb(high_water_bytes_) << " MB" << std::endl;
+	std::cout << "Grown / released:      " << to_mb(retained_bytes_)
+	          << " MB retained, " << released_ << " buffers released"
+	          << std::endl;
+	std::cout << "Working set:           " << to_mb(working_set) << " MB (peak "
+	          << to_mb(peak_working_set) << " MB)" << std::endl;
+}
+
+FramePoolAllocator& frame_allocator() {
+	static FramePoolAllocator* allocator = new FramePoolAllocator();
+	return *allocator;
+}
+
+void get_working_set(size_t* current, size_t* peak) {
+	PROCESS_MEMORY_COUNTERS counters = {};
+	counters.cb = sizeof(counters);
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		*current = *peak = 0;
+		return;
+	}
+	*current = counters.WorkingSetSize;
+	*peak = counters.PeakWorkingSetSize;
+}
+
+int numa_node_for_affinity(uint64_t affinity_mask) {
+	PROCESSOR_NUMBER processor = {};
+	if (affinity_mask != 0) {
+		int index = 0;
+		while (!(affinity_mask & 1)) {
+			affinity_mask >>= 1;
+			++index;
+		}
+		processor.Number = static_cast<BYTE>(index);
+	} else {
+		GetCurrentProcessorNumberEx(&processor);
+	}
+
+	USHORT node = 0;
+	if (!GetNumaProcessorNodeEx(&processor, &node))
+		return -1;
+	return node;
+}
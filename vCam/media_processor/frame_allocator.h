@@ -0,0 +1,105 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+// frame_allocator.h
+
+#pragma once
+
+#ifndef FRAME_ALLOCATOR_H
+#define FRAME_ALLOCATOR_H
+
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <mutex>  // NOLINT(build/c++11)
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// cv::MatAllocator serving frame-sized buffers from a pool.
+//
+// Every decoded frame, clone and imread result is a multi-megabyte buffer.
+// Going through the general purpose heap for each of them costs page faults
+// and allocator contention and fragments the address space over long runs.
+// The pool hands out page aligned buffers from a preallocated slab (on large
+// pages when the account holds SeLockMemoryPrivilege, on the NUMA node of
+// the consuming thread) and keeps released buffers for reuse. Buffers below
+// min_pooled_bytes are left to OpenCV's standard allocator.
+//
+// Regular pages of the slab are faulted in by a background thread, so that
+// reserve() does not delay the first frame; slab buffers join the pool one
+// by one as they become resident.
+class FramePoolAllocator : public cv::MatAllocator {
+ public:
+	explicit FramePoolAllocator(size_t min_pooled_bytes = 256 * 1024,
+	                            size_t max_retained_bytes = 256 << 20);
+
+	// Preallocate count buffers of the given size on a NUMA node
+	// (-1: the node of the calling thread). Returns before the pages are
+	// faulted in.
+	void reserve(size_t bytes, int count, int numa_node = -1);
+
+	// Lock the regular pages of the preallocated slab into the working set
+	// (large pages can't be paged out anyway). The minimum working set has
+	// to be raised to hold them first. Returns false if locking failed.
+	bool lock_slab();
+
+	cv::UMatData* allocate(int dims, const int* sizes, int type,
+	                       void* data, size_t* step, cv::AccessFlag flags,
+	                       cv::UMatUsageFlags usage_flags) const override;
+	bool allocate(cv::UMatData* data, cv::AccessFlag access_flags,
+	              cv::UMatUsageFlags usage_flags) const override;
+	void deallocate(cv::UMatData* data) const override;
+
+	size_t bytes_in_use() const;
+	void print_report() const;
+
+ private:
+	struct Buffer {
+		size_t size;
+		bool   from_slab;
+	};
+
+	uchar* acquire(size_t bytes) const;
+	void   release(uchar* data) const;
+	void   prefault(uchar* slab, size_t slot, size_t total);
+
+	size_t min_pooled_bytes_;
+	size_t max_retained_bytes_;
+	int    numa_node_ = -1;
+	bool   large_pages_ = false;
+
+	mutable std::mutex mtx_;
+	// Free buffers by (page rounded) size, and every buffer owned by the pool.
+	mutable std::unordered_map<size_t, std::vector<uchar*>> free_lists_;
+	mutable std::unordered_map<uchar*, Buffer> buffers_;
+	// Slab buffers by size that the prefault thread has not handed over yet.
+	mutable std::unordered_map<size_t, int> pending_slots_;
+	// Regular page slabs, which lock_slab() pins.
+	std::vector<std::pair<uchar*, size_t>> slabs_;
+	mutable std::condition_variable prefault_cond_;
+
+	mutable uint64_t hits_ = 0;
+	mutable uint64_t misses_ = 0;
+	mutable uint64_t released_ = 0;
+	mutable uint64_t prefault_waits_ = 0;
+	double           prefault_ms_ = 0.0;
+	mutable size_t   slab_bytes_ = 0;
+	size_t           locked_bytes_ = 0;
+	uint32_t         lock_error_ = 0;
+	mutable size_t   retained_bytes_ = 0;
+	mutable size_t   in_use_bytes_ = 0;
+	mutable size_t   high_water_bytes_ = 0;
+};
+
+// The process wide pool. Never destroyed, so Mats released during static
+// destruction can still return their buffers.
+FramePoolAllocator& frame_allocator();
+
+// Current and peak working set (resident memory) of the process in bytes.
+void get_working_set(size_t* current, size_t* peak);
+
+// NUMA node of the lowest processor in an affinity mask, or of the calling
+// thread's processor when the mask is 0.
+int numa_node_for_affinity(uint64_t affinity_mask);
+
+#endif  // FRAME_ALLOCATOR_H
@@ -0,0 +1,391 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+
+#include "frame_recorder.h"  // NOLINT(build/include_subdir)
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+
+struct RecordingHeader {
+	char     magic[4];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t reserved;
+};
+
+const char kMagic[4] = {'V', 'R', 'E', 'C'};
+const uint32_t kVersion = 1;
+
+// Hand a batch to the writer thread once this many records are pending, or
+// after kFlushInterval, whichever comes first.
+const size_t kBatchFrames = 32;
+const std::chrono::milliseconds kFlushInterval(250);
+
+// Individual problems listed by verify_recording before the summary.
+const int kMaxListed = 20;
+
+using milliseconds = std::chrono::duration<double, std::milli>;
+using microseconds = std::chrono::duration<double, std::micro>;
+
+uint64_t frame_key(const FrameRecord& record) {
+	return (static_cast<uint64_t>(static_cast<uint32_t>(record.iteration)) << 32) |
+		static_cast<uint32_t>(record.frame_number);
+}
+
+bool read_recording(const std::string& path,
+                    std::vector<FrameRecord>* records) {
+	std::ifstream file(path, std::ios::binary);
+	RecordingHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+		std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+		header.version != kVersion ||
+		header.record_size != sizeof(FrameRecord)) {
+		std::cerr << "Not a vCam recording: " << path << std::endl;
+		return false;
+	}
+
+	// A record cut short by an interrupted run is ignored.
+	FrameRecord record;
+	while (file.read(reinterpret_cast<char*>(&record), sizeof(record)))
+		records->push_back(record);
+	return true;
+}
+
+bool was_dropped(const FrameRecord& record) {
+	return (record.flags & FrameRecorder::kDropped) != 0;
+}
+
+// Average and maximum of presented - scheduled over the presented frames.
+void print_lateness(const char* label,
+                    const std::vector<const FrameRecord*>& records) {
+	double sum = 0.0, max = 0.0;
+	size_t presented = 0;
+	for (const FrameRecord* record : records) {
+		if (was_dropped(*record))
+			continue;
+		double lateness = record->presented_ms - record->scheduled_ms;
+		sum += lateness;
+		max = (std::max)(max, lateness);
+		presented++;
+	}
+	std::cout << label << (presented == 0 ? 0.0 : sum / presented)
+	          << " / " << max << std::endl;
+}
+
+}  // namespace
+
+static_assert(sizeof(FrameRecord) == 48, "FrameRecord is stored as is");
+
+uint64_t frame_hash(const cv::Mat& frame) {
+	// FNV-1a over 64 bit words in four independent lanes, so the multiplies
+	// of neighbouring words don't wait on each other.
+	const uint64_t kPrime = 0x100000001b3ULL;
+	uint64_t lanes[4] = {0xcbf29ce484222325ULL, 0x9e3779b97f4a7c15ULL,
+	                     0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL};
+	lanes[0] = (lanes[0] ^ static_cast<uint64_t>(frame.rows)) * kPrime;
+	lanes[1] = (lanes[1] ^ static_cast<uint64_t>(frame.cols)) * kPrime;
+	lanes[2] = (lanes[2] ^ static_cast<uint64_t>(frame.type())) * kPrime;
+
+	size_t row_bytes = frame.cols * frame.elemSize();
+	for (int y = 0; y < frame.rows; ++y) {
+		const uchar* row = frame.ptr(y);
+		size_t x = 0;
+		for (; x + 32 <= row_bytes; x += 32) {
+			for (int i = 0; i < 4; ++i) {
+				uint64_t word;
+				std::memcpy(&word, row + x + i * 8, sizeof(word));
+				lanes[i] = (lanes[i] ^ word) * kPrime;
+			}
+		}
+		for (; x < row_bytes; ++x)
+			lanes[3] = (lanes[3] ^ row[x]) * kPrime;
+	}
+
+	uint64_t hash = 0;
+	for (uint64_t lane : lanes) {
+		hash = (hash ^ lane) * kPrime;
+		hash ^= hash >> 29;
+	}
+	return hash;
+}
+
+bool FrameRecorder::open(const std::string& path) {
+	file_.open(path, std::ios::binary | std::ios::trunc);
+	RecordingHeader header = {};
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.record_size = sizeof(FrameRecord);
+	if (!file_.write(reinterpret_cast<const char*>(&header), sizeof(header))) {
+		std::cerr << "Failed to create recording: " << path << std::endl;
+		return false;
+	}
+
+	path_ = path;
+	start_ = std::chrono::steady_clock::now();
+	pending_.reserve(kBatchFrames * 2);
+	writer_ = std::thread(&FrameRecorder::writer, this);
+	return true;
+}
+
+bool FrameRecorder::close() {
+	if (!is_open())
+		return true;
+
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		closing_ = true;
+	}
+	cond_.notify_one();
+	writer_.join();
+
+	file_.close();
+	if (write_failed_ || file_.fail()) {
+		std::cerr << "Failed to write recording: " << path_ << std::endl;
+		return false;
+	}
+	return true;
+}
+
+uint64_t FrameRecorder::hash_content(const cv::Mat& image) {
+	auto hash_start = std::chrono::steady_clock::now();
+	uint64_t hash = frame_hash(image);
+	double us = microseconds(std::chrono::steady_clock::now() -
+	                         hash_start).count();
+	hash_total_us_ += us;
+	hash_max_us_ = (std::max)(hash_max_us_, us);
+	frames_hashed_++;
+	return hash;
+}
+
+void FrameRecorder::on_frame_presented(const MediaFrame& frame,
+                                       uint64_t hash,
+                                       time_point scheduled,
+                                       time_point presented) {
+	last_hash_ = hash;
+	frames_presented_++;
+	record(frame, 0, hash, scheduled, presented);
+}
+
+void FrameRecorder::on_frame_repeated(const MediaFrame& frame,
+                                      time_point presented) {
+	// The repeated frame is the last presented one, unchanged.
+	frames_repeated_++;
+	record(frame, kRepeated, last_hash_, presented, presented);
+}
+
+void FrameRecorder::on_frame_dropped(const MediaFrame& frame,
+                                     time_point scheduled) {
+	frames_dropped_++;
+	record(frame, kDropped, 0, scheduled, time_point());
+}
+
+void FrameRecorder::record(const MediaFrame& frame, uint32_t flags,
+                           uint64_t hash, time_point scheduled,
+                           time_point presented) {
+	FrameRecord entry;
+	entry.sequence = sequence_++;
+	entry.flags = flags;
+	entry.frame_number = frame.frame_number;
+	entry.iteration = frame.iteration;
+	entry.pts_ms = frame.pts;
+	entry.scheduled_ms = milliseconds(scheduled - start_).count();
+	entry.presented_ms = presented == time_point() ? -1.0 :
+		milliseconds(presented - start_).count();
+	entry.hash = hash;
+
+	bool flush;
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		pending_.push_back(entry);
+		max_pending_ = (std::max)(max_pending_, pending_.size());
+		flush = pending_.size() >= kBatchFrames;
+	}
+	if (flush)
+		cond_.notify_one();
+}
+
+void FrameRecorder::writer() {
+	std::vector<FrameRecord> batch;
+	batch.reserve(kBatchFrames * 2);
+
+	std::unique_lock<std::mutex> lock(mtx_);
+	while (true) {
+		cond_.wait_for(lock, kFlushInterval, [this] {
+			return closing_ || pending_.size() >= kBatchFrames;
+		});
+		batch.swap(pending_);
+		bool closing = closing_;
+		lock.unlock();
+
+		if (!batch.empty()) {
+			auto write_start = std::chrono::steady_clock::now();
+			size_t bytes = batch.size() * sizeof(FrameRecord);
+			if (!file_.write(reinterpret_cast<const char*>(batch.data()),
+			                 bytes))
+				write_failed_ = true;
+			double ms = milliseconds(std::chrono::steady_clock::now() -
+			                         write_start).count();
+			write_total_ms_ += ms;
+			write_max_ms_ = (std::max)(write_max_ms_, ms);
+			batches_++;
+			bytes_written_ += bytes;
+			batch.clear();
+		}
+
+		lock.lock();
+		if (closing && pending_.empty())
+			break;
+	}
+}
+
+void FrameRecorder::print_report() const {
+	if (path_.empty())
+		return;
+
+	std::cout << std::endl << "Recording:" << std::endl;
+	std::cout << "File:                  " << path_ << std::endl;
+	std::cout << "Frames recorded:       " << frames_presented_
+	          << " presented, " << frames_repeated_ << " repeated, "
+	          << frames_dropped_ << " dropped" << std::endl;
+	if (frames_hashed_ > 0)
+		std::cout << "Content hash (us):     avg "
+		          << hash_total_us_ / frames_hashed_
+		          << " / max " << hash_max_us_ << std::endl;
+	std::cout << "Pending records (max): " << max_pending_ << std::endl;
+	std::cout << "Batches written:       " << batches_ << " ("
+	          << bytes_written_ << " bytes)" << std::endl;
+	if (batches_ > 0)
+		std::cout << "Write time (ms):       avg " << write_total_ms_ / batches_
+		          << " / max " << write_max_ms_ << std::endl;
+}
+
+bool verify_recording(const std::string& golden_path,
+                      const std::string& run_path,
+                      double tolerance_ms) {
+	std::vector<FrameRecord> golden_records, run_records;
+	if (!read_recording(golden_path, &golden_records) ||
+		!read_recording(run_path, &run_records))
+		return false;
+
+	// Only frames presented for the first time are compared; repeats depend
+	// on how fast decode was, drops in the run are reported as missing
+	// frames. Frames the golden run dropped stay in the index so the run may
+	// present them, but they carry no hash to compare against and are not
+	// missing when the run drops them too.
+	std::vector<const FrameRecord*> golden, run;
+	size_t golden_dropped = 0, run_repeated = 0, run_dropped = 0;
+	for (const FrameRecord& record : golden_records) {
+		if (record.flags & FrameRecorder::kRepeated)
+			continue;
+		if (was_dropped(record))
+			golden_dropped++;
+		golden.push_back(&record);
+	}
+	for (const FrameRecord& record : run_records) {
+		if (record.flags & FrameRecorder::kRepeated)
+			run_repeated++;
+		else if (record.flags & FrameRecorder::kDropped)
+			run_dropped++;
+		else
+			run.push_back(&record);
+	}
+
+	std::unordered_map<uint64_t, size_t> golden_index;
+	for (size_t i = 0; i < golden.size(); ++i)
+		golden_index.emplace(frame_key(*golden[i]), i);
+
+	std::cout << std::endl << "Verifying " << run_path << " against "
+	          << golden_path << ":" << std::endl;
+
+	int listed = 0;
+	auto list = [&listed](const FrameRecord& record, const std::string& what) {
+		if (listed++ < kMaxListed)
+			std::cout << "  iteration " << record.iteration << " frame "
+			          << record.frame_number << ": " << what << std::endl;
+	};
+
+	std::vector<bool> matched(golden.size(), false);
+	size_t mismatched = 0, unexpected = 0, reordered = 0, deviations = 0;
+	double max_deviation = 0.0;
+	size_t last_pos = 0;
+	bool have_last = false;
+	const FrameRecord* previous = nullptr;
+	size_t previous_pos = 0;
+
+	for (const FrameRecord* record : run) {
+		auto it = golden_index.find(frame_key(*record));
+		if (it == golden_index.end() || matched[it->second]) {
+			unexpected++;
+			list(*record, "not in the golden recording");
+			previous = nullptr;
+			continue;
+		}
+
+		size_t pos = it->second;
+		matched[pos] = true;
+		const FrameRecord& expected = *golden[pos];
+
+		if (!was_dropped(expected) && record->hash != expected.hash) {
+			mismatched++;
+			list(*record, "content differs");
+		}
+
+		if (have_last && pos < last_pos) {
+			reordered++;
+			list(*record, "presented out of order");
+		} else {
+			last_pos = pos;
+			have_last = true;
+		}
+
+		// Compare the interval since the previous frame with the golden one
+		// where both runs presented the same two consecutive frames.
+		if (previous && pos == previous_pos + 1 && !was_dropped(expected) &&
+			!was_dropped(*golden[previous_pos])) {
+			double deviation =
+				(record->presented_ms - previous->presented_ms) -
+				(expected.presented_ms - golden[previous_pos]->presented_ms);
+			max_deviation = (std::max)(max_deviation, std::abs(deviation));
+			if (std::abs(deviation) > tolerance_ms) {
+				deviations++;
+				list(*record, "presented " + std::to_string(deviation) +
+				     " ms off the golden interval");
+			}
+		}
+		previous = record;
+		previous_pos = pos;
+	}
+
+	size_t missing = 0;
+	for (size_t i = 0; i < golden.size(); ++i) {
+		if (!matched[i] && !was_dropped(*golden[i]))
+			missing++;
+	}
+	if (listed > kMaxListed)
+		std::cout << "  ... " << listed - kMaxListed << " more" << std::endl;
+
+	std::cout << "Golden frames:         " << golden.size() << " ("
+	          << golden_dropped << " dropped by load shedding)" << std::endl;
+	std::cout << "Run frames:            " << run.size() << " ("
+	          << run_repeated << " repeated, " << run_dropped
+	          << " dropped by load shedding)" << std::endl;
+	std::cout << "Content mismatches:    " << mismatched << std::endl;
+	std::cout << "Missing frames:        " << missing << std::endl;
+	std::cout << "Unexpected frames:     " << unexpected << std::endl;
+	std::cout << "Reordered frames:      " << reordered << std::endl;
+	std::cout << "Timing deviations:     " << deviations << " (> "
+	          << tolerance_ms << " ms, max " << max_deviation << " ms)"
+	          << std::endl;
+	print_lateness("Golden lateness (ms):  avg ", golden);
+	print_lateness("Run lateness (ms):     avg ", run);
+
+	bool passed = golden.size() > golden_dropped && mismatched == 0 && missing == 0 &&
+		unexpected == 0 && reordered == 0 && deviations == 0;
+	std::cout << "Result:                " << (passed ? "PASS" : "FAIL")
+	          << std::endl;
+	return passed;
+}
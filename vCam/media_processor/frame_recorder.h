@@ -0,0 +1,120 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+// frame_recorder.h
+
+#pragma once
+
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <fstream>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "media_processor.h"  // NOLINT(build/include_subdir)
+
+// One entry of a recording, stored as is after a small file header.
+// Times are milliseconds since the recording was opened, presented_ms is
+// negative for frames that were dropped.
+struct FrameRecord {
+	uint32_t sequence;
+	uint32_t flags;
+	int32_t  frame_number;
+	int32_t  iteration;
+	double   pts_ms;
+	double   scheduled_ms;
+	double   presented_ms;
+	uint64_t hash;
+};
+
+// Records what the consumer hands to SetBuffer: a content hash of every
+// presented frame together with its scheduled and actual present time.
+//
+// The consumer hashes a frame once the filters have run but before the text
+// overlay and the probe marker are burnt in, since those carry wall clock
+// times and sequence numbers that differ from run to run. Hashing happens
+// while the frame waits for its deadline; after presenting, a fixed-size
+// record is appended to a pending batch. A writer thread flushes the batches
+// to disk, so file I/O never runs on the pacing thread.
+class FrameRecorder {
+ public:
+	enum Flags : uint32_t {
+		// The queue ran dry and the previous frame was presented again.
+		kRepeated = 1,
+		// Dropped by load shedding, not presented.
+		kDropped = 2,
+	};
+
+	using time_point = std::chrono::steady_clock::time_point;
+
+	~FrameRecorder() { close(); }
+
+	bool open(const std::string& path);
+	bool is_open() const { return writer_.joinable(); }
+	// Flush the pending records and close the file. Returns false if any
+	// write failed.
+	bool close();
+
+	// Consumer side. hash_content() returns the hash to pass to
+	// on_frame_presented().
+	uint64_t hash_content(const cv::Mat& image);
+	void on_frame_presented(const MediaFrame& frame,
+	                        uint64_t hash,
+	                        time_point scheduled,
+	                        time_point presented);
+	void on_frame_repeated(const MediaFrame& frame, time_point presented);
+	void on_frame_dropped(const MediaFrame& frame, time_point scheduled);
+
+	void print_report() const;
+
+ private:
+	void record(const MediaFrame& frame, uint32_t flags, uint64_t hash,
+	            time_point scheduled, time_point presented);
+	void writer();
+
+	std::string   path_;
+	std::ofstream file_;
+	time_point    start_;
+	uint32_t      sequence_ = 0;
+	uint64_t      last_hash_ = 0;
+
+	std::mutex                mtx_;
+	std::condition_variable   cond_;
+	std::vector<FrameRecord>  pending_;
+	bool                      closing_ = false;
+	std::thread               writer_;
+
+	// Consumer thread statistics.
+	uint64_t frames_presented_ = 0;
+	uint64_t frames_repeated_ = 0;
+	uint64_t frames_dropped_ = 0;
+	uint64_t frames_hashed_ = 0;
+	double   hash_total_us_ = 0.0;
+	double   hash_max_us_ = 0.0;
+	size_t   max_pending_ = 0;
+
+	// Writer thread statistics, read after it has been joined.
+	uint64_t batches_ = 0;
+	uint64_t bytes_written_ = 0;
+	double   write_total_ms_ = 0.0;
+	double   write_max_ms_ = 0.0;
+	bool     write_failed_ = false;
+};
+
+// 64 bit content hash of a frame's pixels.
+uint64_t frame_hash(const cv::Mat& frame);
+
+// Compare a recording against a golden one and report content mismatches,
+// missing, unexpected and reordered frames and presentation intervals that
+// deviate by more than tolerance_ms. Returns false if any were found.
+bool verify_recording(const std::string& golden_path,
+                      const std::string& run_path,
+                      double tolerance_ms);
+
+#endif  // FRAME_RECORDER_H
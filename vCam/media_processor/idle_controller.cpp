@@ -0,0 +1,125 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+
+#include "idle_controller.h"  // NOLINT(build/include_subdir)
+
+#include <windows.h>
+
+#include <iostream>
+
+namespace {
+
+// User and kernel time consumed by the process so far.
+double process_cpu_ms() {
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		return 0.0;
+
+	auto to_100ns = [](const FILETIME& time) {
+		return (static_cast<uint64_t>(time.dwHighDateTime) << 32) |
+			time.dwLowDateTime;
+	};
+	return (to_100ns(kernel) + to_100ns(user)) / 10000.0;
+}
+
+// Share of one core used by cpu_ms over seconds.
+double core_percent(double cpu_ms, double seconds) {
+	return seconds > 0 ? cpu_ms / (seconds * 10.0) : 0.0;
+}
+
+}  // namespace
+
+void IdleController::start() {
+	std::lock_guard<std::mutex> lock(mtx_);
+	start_ = clock::now();
+	start_cpu_ms_ = process_cpu_ms();
+}
+
+void IdleController::set(Reason reason, bool active) {
+	std::lock_guard<std::mutex> lock(mtx_);
+	uint32_t reasons = reasons_;
+	if (active && !(reasons & reason)) {
+		if (reason == kCommand)
+			command_pauses_++;
+		else
+			unwatched_periods_++;
+	}
+	update(active ? reasons | reason : reasons & ~reason);
+}
+
+void IdleController::toggle(Reason reason) {
+	set(reason, !(reasons_ & reason));
+}
+
+void IdleController::update(uint32_t reasons) {
+	bool was_idle = reasons_ != 0;
+	reasons_ = reasons;
+	if (!was_idle && reasons != 0) {
+		periods_++;
+		idle_since_ = clock::now();
+		idle_since_cpu_ms_ = process_cpu_ms();
+	} else if (was_idle && reasons == 0) {
+		std::chrono::duration<double> idle = clock::now() - idle_since_;
+		idle_seconds_ += idle.count();
+		idle_cpu_ms_ += process_cpu_ms() - idle_since_cpu_ms_;
+		cond_.notify_all();
+	}
+}
+
+bool IdleController::wait_while_idle(const std::atomic<bool>& stop) {
+	if (reasons_ == 0)
+		return false;
+
+	std::unique_lock<std::mutex> lock(mtx_);
+	cond_.wait(lock, [this, &stop] { return reasons_ == 0 || stop; });
+	return true;
+}
+
+void IdleController::interrupt() {
+	// Taking the lock orders the caller's stop flag before a waiter's
+	// predicate check, so the notification can't be lost.
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+	}
+	cond_.notify_all();
+}
+
+std::string IdleController::status() const {
+	uint32_t reasons = reasons_;
+	if (reasons & kCommand)
+		return "paused";
+	if (reasons & kNoConsumers)
+		return "idle, no application is watching";
+	return "playing";
+}
+
+void IdleController::print_report() const {
+	std::lock_guard<std::mutex> lock(mtx_);
+	if (periods_ == 0)
+		return;
+
+	// Include a period that is still open, e.g. vCam stopped while paused.
+	double idle_seconds = idle_seconds_;
+	double idle_cpu_ms = idle_cpu_ms_;
+	double cpu_ms = process_cpu_ms();
+	if (reasons_ != 0) {
+		std::chrono::duration<double> idle = clock::now() - idle_since_;
+		idle_seconds += idle.count();
+		idle_cpu_ms += cpu_ms - idle_since_cpu_ms_;
+	}
+	std::chrono::duration<double> total = clock::now() - start_;
+	double playing_seconds = total.count() - idle_seconds;
+	double playing_cpu_ms = cpu_ms - start_cpu_ms_ - idle_cpu_ms;
+
+	std::cout << std::endl << "Idle:" << std::endl;
+	std::cout << "Idle periods:          " << periods_ << " ("
+	          << command_pauses_ << " paused, " << unwatched_periods_
+	          << " not watched)" << std::endl;
+	std::cout << "Time idle / playing:   " << idle_seconds << " s / "
+	          << playing_seconds << " s" << std::endl;
+	std::cout << "CPU while idle:        " << idle_cpu_ms << " ms ("
+	          << core_percent(idle_cpu_ms, idle_seconds) << " % of a core)"
+	          << std::endl;
+	std::cout << "CPU while playing:     " << playing_cpu_ms << " ms ("
+	          << core_percent(playing_cpu_ms, playing_seconds)
+	          << " % of a core)" << std::endl;
+}
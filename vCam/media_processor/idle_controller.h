@@ -0,0 +1,71 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+// idle_controller.h
+
+#pragma once
+
+#ifndef IDLE_CONTROLLER_H
+#define IDLE_CONTROLLER_H
+
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+
+// Paused/idle state of the pipeline.
+//
+// While any reason is set the producer stops decoding and the consumer
+// blocks on a condition variable, keeping the last presented frame. Paused
+// from the keyboard, no pipeline thread wakes up until playback resumes;
+// idling for lack of consumers additionally runs the sink monitor, which
+// polls the driver twice a second. The process CPU time spent while idle and
+// while playing is measured for the report.
+class IdleController {
+ public:
+	enum Reason : uint32_t {
+		// Paused from the keyboard.
+		kCommand = 1,
+		// No application has the virtual camera open.
+		kNoConsumers = 2,
+	};
+
+	// Take the CPU time baseline for the report.
+	void start();
+
+	// Set or clear a reason. The pipeline idles while any reason is set.
+	void set(Reason reason, bool active);
+	void toggle(Reason reason);
+	bool idle() const { return reasons_ != 0; }
+
+	// Block while the pipeline is idle and stop is not set. Returns true if
+	// the caller had to wait.
+	bool wait_while_idle(const std::atomic<bool>& stop);
+	// Wake the waiting threads, e.g. after stop was set.
+	void interrupt();
+
+	std::string status() const;
+	void print_report() const;
+
+ private:
+	using clock = std::chrono::steady_clock;
+
+	void update(uint32_t reasons);
+
+	mutable std::mutex      mtx_;
+	std::condition_variable cond_;
+	std::atomic<uint32_t>   reasons_{0};
+
+	clock::time_point start_;
+	double            start_cpu_ms_ = 0.0;
+	clock::time_point idle_since_;
+	double            idle_since_cpu_ms_ = 0.0;
+
+	uint64_t periods_ = 0;
+	uint64_t command_pauses_ = 0;
+	uint64_t unwatched_periods_ = 0;
+	double   idle_seconds_ = 0.0;
+	double   idle_cpu_ms_ = 0.0;
+};
+
+#endif  // IDLE_CONTROLLER_H
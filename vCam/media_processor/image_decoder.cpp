@@ -0,0 +1,561 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+
+#include "image_decoder.h"  // NOLINT(build/include_subdir)
+
+#include <algorithm>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#if TURBOJPEG_ENABLED
+#include <turbojpeg.h>
+#pragma comment(lib, "turbojpeg.lib")
+#endif
+
+#if STB_ENABLED
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"  // NOLINT(build/include_subdir)
+#endif
+
+namespace {
+
+enum class ImageFormat {
+	kJpeg,
+	kPng,
+	kBmp,
+	kGif,
+	kOther,
+};
+
+// Each image is decoded this many times by the benchmark, the best run
+// counts.
+const int kBenchmarkRuns = 3;
+
+using milliseconds = std::chrono::duration<double, std::milli>;
+
+const char* format_name(ImageFormat format) {
+	switch (format) {
+	case ImageFormat::kJpeg: return "JPEG";
+	case ImageFormat::kPng:  return "PNG";
+	case ImageFormat::kBmp:  return "BMP";
+	case ImageFormat::kGif:  return "GIF";
+	default:                 return "other";
+	}
+}
+
+ImageFormat detect_format(const std::vector<uchar>& data) {
+	auto starts_with = [&data](std::initializer_list<uchar> signature) {
+		return data.size() >= signature.size() &&
+			std::equal(signature.begin(), signature.end(), data.begin());
+	};
+	if (starts_with({0xFF, 0xD8, 0xFF}))
+		return ImageFormat::kJpeg;
+	if (starts_with({0x89, 'P', 'N', 'G'}))
+		return ImageFormat::kPng;
+	if (starts_with({'B', 'M'}))
+		return ImageFormat::kBmp;
+	if (starts_with({'G', 'I', 'F', '8'}))
+		return ImageFormat::kGif;
+	return ImageFormat::kOther;
+}
+
+bool read_file(const std::string& path, std::vector<uchar>* data) {
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+		return false;
+	data->resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	return static_cast<bool>(
+		file.read(reinterpret_cast<char*>(data->data()), data->size()));
+}
+
+// Call visit(marker, offset, length) for each marker segment of a JPEG
+// stream up to the start of scan, where offset is that of the marker and
+// length covers the segment after it. Stops when visit returns true.
+template <typename Visit>
+void walk_jpeg_segments(const std::vector<uchar>& data, Visit visit) {
+	size_t pos = 2;
+	while (pos + 4 <= data.size()) {
+		if (data[pos] != 0xFF)
+			return;
+		uchar marker = data[pos + 1];
+		if (marker == 0xFF) {
+			// Fill byte
+			pos++;
+			continue;
+		}
+		if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+			// Markers without a segment
+			pos += 2;
+			continue;
+		}
+		if (marker == 0xD9 || marker == 0xDA)
+			return;
+
+		size_t length = (data[pos + 2] << 8) | data[pos + 3];
+		if (visit(marker, pos, length))
+			return;
+		pos += 2 + length;
+	}
+}
+
+// Image size from the SOFn segment of a JPEG stream, without decoding it.
+bool jpeg_size(const std::vector<uchar>& data, cv::Size* size) {
+	bool found = false;
+	walk_jpeg_segments(data, [&](uchar marker, size_t pos, size_t) {
+		// SOF0-SOF15, except DHT, JPG and DAC which share the range.
+		if (marker < 0xC0 || marker > 0xCF ||
+			marker == 0xC4 || marker == 0xC8 || marker == 0xCC)
+			return false;
+		if (pos + 9 <= data.size()) {
+			*size = cv::Size((data[pos + 7] << 8) | data[pos + 8],
+			                 (data[pos + 5] << 8) | data[pos + 6]);
+			found = size->width > 0 && size->height > 0;
+		}
+		return true;
+	});
+	return found;
+}
+
+// EXIF orientation (1-8, 1: stored upright) from the IFD0 of the APP1 Exif
+// segment of a JPEG stream.
+int jpeg_orientation(const std::vector<uchar>& data) {
+	int orientation = 1;
+	walk_jpeg_segments(data, [&](uchar marker, size_t pos, size_t length) {
+		if (marker != 0xE1)
+			return false;
+		size_t end = (std::min)(pos + 2 + length, data.size());
+		size_t tiff = pos + 10;
+		if (tiff + 8 > end ||
+			std::memcmp(&data[pos + 4], "Exif\0\0", 6) != 0)
+			return false;
+
+		bool little_endian = data[tiff] == 'I';
+		auto read16 = [&](size_t at) -> uint32_t {
+			return little_endian ? data[at] | (data[at + 1] << 8)
+			                     : (data[at] << 8) | data[at + 1];
+		};
+		auto read32 = [&](size_t at) -> uint32_t {
+			return little_endian
+				? read16(at) | (read16(at + 2) << 16)
+				: (read16(at) << 16) | read16(at + 2);
+		};
+		if (read16(tiff + 2) != 42)
+			return true;
+
+		size_t ifd = tiff + read32(tiff + 4);
+		if (ifd < tiff || ifd + 2 > end)
+			return true;
+		uint32_t entries = read16(ifd);
+		for (uint32_t i = 0; i < entries; ++i) {
+			size_t entry = ifd + 2 + 12 * i;
+			if (entry + 12 > end)
+				break;
+			// Orientation, a single SHORT stored in the value field.
+			if (read16(entry) == 0x0112 && read16(entry + 2) == 3) {
+				uint32_t value = read16(entry + 8);
+				if (value >= 1 && value <= 8)
+					orientation = static_cast<int>(value);
+				break;
+			}
+		}
+		return true;
+	});
+	return orientation;
+}
+
+// Size of a stored image once its EXIF orientation is applied; 5-8 turn it
+// by 90 degrees.
+cv::Size oriented_size(cv::Size size, int orientation) {
+	return orientation >= 5 ? cv::Size(size.height, size.width) : size;
+}
+
+// Turn a decoded image upright. OpenCV does this itself, turbojpeg and
+// stb_image don't.
+cv::Mat apply_orientation(const cv::Mat& image, int orientation) {
+	cv::Mat upright;
+	switch (orientation) {
+	case 2: cv::flip(image, upright, 1); break;
+	case 3: cv::rotate(image, upright, cv::ROTATE_180); break;
+	case 4: cv::flip(image, upright, 0); break;
+	case 5: cv::transpose(image, upright); break;
+	case 6: cv::rotate(image, upright, cv::ROTATE_90_CLOCKWISE); break;
+	case 7:
+		cv::transpose(image, upright);
+		cv::flip(upright, upright, -1);
+		break;
+	case 8: cv::rotate(image, upright, cv::ROTATE_90_COUNTERCLOCKWISE); break;
+	default: return image;
+	}
+	return upright;
+}
+
+// Size of an image scaled to fit output, keeping its aspect ratio.
+cv::Size fit_size(cv::Size image, cv::Size output) {
+	double scale = (std::min)(
+		static_cast<double>(output.width) / image.width,
+		static_cast<double>(output.height) / image.height);
+	return cv::Size(
+		(std::clamp)(static_cast<int>(image.width * scale + 0.5), 1, output.width),
+		(std::clamp)(static_cast<int>(image.height * scale + 0.5), 1, output.height));
+}
+
+bool backend_supports(DecoderBackend backend, ImageFormat format) {
+	switch (backend) {
+	case DecoderBackend::kTurboJpeg: return format == ImageFormat::kJpeg;
+	case DecoderBackend::kStb:       return format != ImageFormat::kOther;
+	default:                         return true;
+	}
+}
+
+DecoderBackend select_backend(DecoderBackend requested, ImageFormat format) {
+	if (requested == DecoderBackend::kAuto) {
+		if (format == ImageFormat::kJpeg &&
+			decoder_backend_available(DecoderBackend::kTurboJpeg))
+			return DecoderBackend::kTurboJpeg;
+		if (format == ImageFormat::kGif &&
+			decoder_backend_available(DecoderBackend::kStb))
+			return DecoderBackend::kStb;
+		return DecoderBackend::kOpenCV;
+	}
+	return backend_supports(requested, format) ? requested :
+		DecoderBackend::kOpenCV;
+}
+
+cv::Mat decode_opencv(const std::vector<uchar>& data, ImageFormat format,
+                      int orientation, cv::Size output, bool reduce) {
+	// The reduced modes only save work for JPEG, other formats are decoded
+	// at full size and resized. OpenCV applies the EXIF orientation, so the
+	// scale is picked for the upright size.
+	int flags = cv::IMREAD_COLOR;
+	cv::Size size;
+	if (reduce && format == ImageFormat::kJpeg && jpeg_size(data, &size)) {
+		switch (reduced_scale(oriented_size(size, orientation), output)) {
+		case 8: flags = cv::IMREAD_REDUCED_COLOR_8; break;
+		case 4: flags = cv::IMREAD_REDUCED_COLOR_4; break;
+		case 2: flags = cv::IMREAD_REDUCED_COLOR_2; break;
+		}
+	}
+	return cv::imdecode(data, flags);
+}
+
+#if TURBOJPEG_ENABLED
+// One decompressor per thread, reused for every image.
+struct TurboJpegHandle {
+	tjhandle handle = tjInitDecompress();
+	~TurboJpegHandle() {
+		if (handle)
+			tjDestroy(handle);
+	}
+};
+
+cv::Mat decode_turbojpeg(const std::vector<uchar>& data, int orientation,
+                         cv::Size output, bool reduce) {
+	thread_local TurboJpegHandle turbo;
+	unsigned long size = static_cast<unsigned long>(data.size());  // NOLINT(runtime/int)
+	int width, height, subsampling, colorspace;
+	if (!turbo.handle ||
+		tjDecompressHeader3(turbo.handle, data.data(), size, &width, &height,
+		                    &subsampling, &colorspace) != 0)
+		return cv::Mat();
+
+	// Scaled in the DCT domain, only the needed coefficients are decoded.
+	// The scale has to cover the output once the image is turned upright.
+	tjscalingfactor factor = {1, reduce ? reduced_scale(
+		oriented_size(cv::Size(width, height), orientation), output) : 1};
+	cv::Mat image(TJSCALED(height, factor), TJSCALED(width, factor), CV_8UC3);
+	if (tjDecompress2(turbo.handle, data.data(), size, image.data, image.cols,
+	                  static_cast<int>(image.step), image.rows, TJPF_BGR,
+	                  TJFLAG_FASTDCT) != 0)
+		return cv::Mat();
+	return apply_orientation(image, orientation);
+}
+#endif
+
+#if STB_ENABLED
+cv::Mat decode_stb(const std::vector<uchar>& data, int orientation) {
+	int width, height, channels;
+	stbi_uc* pixels = stbi_load_from_memory(data.data(),
+	                                        static_cast<int>(data.size()),
+	                                        &width, &height, &channels,
+	                                        STBI_rgb);
+	if (!pixels)
+		return cv::Mat();
+
+	cv::Mat image;
+	cv::cvtColor(cv::Mat(height, width, CV_8UC3, pixels), image,
+	             cv::COLOR_RGB2BGR);
+	stbi_image_free(pixels);
+	return apply_orientation(image, orientation);
+}
+#endif
+
+// Decode with the given backend, or with OpenCV when that fails. Returns
+// the backend that decoded the image; image is left empty if none could.
+DecoderBackend decode_with(DecoderBackend backend,
+                           const std::vector<uchar>& data,
+                           ImageFormat format,
+                           cv::Size output,
+                           bool reduce,
+                           cv::Mat* image) {
+	// imdecode asserts on an empty buffer and a corrupt file can make a
+	// backend throw; like with imread, such files just don't decode.
+	image->release();
+	if (data.empty())
+		return DecoderBackend::kOpenCV;
+	try {
+		int orientation =
+			format == ImageFormat::kJpeg ? jpeg_orientation(data) : 1;
+#if TURBOJPEG_ENABLED
+		if (backend == DecoderBackend::kTurboJpeg) {
+			*image = decode_turbojpeg(data, orientation, output, reduce);
+			if (!image->empty())
+				return backend;
+		}
+#endif
+#if STB_ENABLED
+		if (backend == DecoderBackend::kStb) {
+			*image = decode_stb(data, orientation);
+			if (!image->empty())
+				return backend;
+		}
+#endif
+		*image = decode_opencv(data, format, orientation, output, reduce);
+	} catch (const cv::Exception&) {
+		image->release();
+	}
+	return DecoderBackend::kOpenCV;
+}
+
+}  // namespace
+
+bool parse_decoder_backend(const std::string& name, DecoderBackend* backend) {
+	for (DecoderBackend candidate : {DecoderBackend::kAuto,
+	                                 DecoderBackend::kOpenCV,
+	                                 DecoderBackend::kTurboJpeg,
+	                                 DecoderBackend::kStb}) {
+		if (name == decoder_backend_name(candidate)) {
+			*backend = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* decoder_backend_name(DecoderBackend backend) {
+	switch (backend) {
+	case DecoderBackend::kOpenCV:    return "opencv";
+	case DecoderBackend::kTurboJpeg: return "turbojpeg";
+	case DecoderBackend::kStb:       return "stb";
+	default:                         return "auto";
+	}
+}
+
+bool decoder_backend_available(DecoderBackend backend) {
+	switch (backend) {
+#if !TURBOJPEG_ENABLED
+	case DecoderBackend::kTurboJpeg: return false;
+#endif
+#if !STB_ENABLED
+	case DecoderBackend::kStb:       return false;
+#endif
+	default:                         return true;
+	}
+}
+
+int reduced_scale(cv::Size image, cv::Size output) {
+	if (image.width <= 0 || image.height <= 0)
+		return 1;
+
+	cv::Size fitted = fit_size(image, output);
+	for (int denom : {8, 4, 2}) {
+		// libjpeg rounds scaled dimensions up.
+		if ((image.width + denom - 1) / denom >= fitted.width &&
+			(image.height + denom - 1) / denom >= fitted.height)
+			return denom;
+	}
+	return 1;
+}
+
+cv::Mat fit_to_output(const cv::Mat& image, cv::Size output) {
+	if (image.empty() || image.size() == output)
+		return image;
+
+	cv::Size fitted = fit_size(image.size(), output);
+	cv::Mat frame(output, CV_8UC3, cv::Scalar(0, 0, 0));
+	cv::Mat roi = frame(cv::Rect((output.width - fitted.width) / 2,
+	                             (output.height - fitted.height) / 2,
+	                             fitted.width, fitted.height));
+	cv::resize(image, roi, fitted, 0, 0,
+	           fitted.width < image.cols ? cv::INTER_AREA : cv::INTER_LINEAR);
+	return frame;
+}
+
+bool ImageDecoder::init(DecoderBackend backend, cv::Size output) {
+	if (!decoder_backend_available(backend)) {
+		std::cerr << "Decoder " << decoder_backend_name(backend)
+		          << " is not available in this build." << std::endl;
+		return false;
+	}
+	backend_ = backend;
+	output_ = output;
+	return true;
+}
+
+cv::Mat ImageDecoder::decode(const std::string& path) {
+	std::vector<uchar> data;
+	if (!read_file(path, &data))
+		return cv::Mat();
+
+	auto start = std::chrono::steady_clock::now();
+	ImageFormat format = detect_format(data);
+	cv::Mat image;
+	DecoderBackend used = decode_with(select_backend(backend_, format), data,
+	                                  format, output_, true, &image);
+	if (image.empty())
+		return image;
+
+	cv::Size source;
+	if (format != ImageFormat::kJpeg || !jpeg_size(data, &source))
+		source = image.size();
+	cv::Mat frame = fit_to_output(image, output_);
+	double ms = milliseconds(std::chrono::steady_clock::now() - start).count();
+
+	Stats& stats = stats_[static_cast<int>(used)];
+	stats.images++;
+	stats.total_ms += ms;
+	stats.max_ms = (std::max)(stats.max_ms, ms);
+	stats.decoded_pixels += static_cast<double>(image.total());
+	stats.source_pixels += static_cast<double>(source.area());
+	return frame;
+}
+
+void ImageDecoder::print_report() const {
+	bool header = false;
+	for (DecoderBackend backend : {DecoderBackend::kOpenCV,
+	                               DecoderBackend::kTurboJpeg,
+	                               DecoderBackend::kStb}) {
+		const Stats& stats = stats_[static_cast<int>(backend)];
+		if (stats.images == 0)
+			continue;
+		if (!header) {
+			std::cout << std::endl << "Image decode:" << std::endl;
+			header = true;
+		}
+		std::cout << std::left << std::setw(23)
+		          << (std::string(decoder_backend_name(backend)) + ":")
+		          << std::right << stats.images << " images, avg "
+		          << stats.total_ms / stats.images << " ms / max "
+		          << stats.max_ms << " ms, "
+		          << 100.0 * stats.decoded_pixels / stats.source_pixels
+		          << " % of the source pixels decoded" << std::endl;
+	}
+}
+
+bool run_decoder_benchmark(const std::string& directory, cv::Size output) {
+	struct Input {
+		ImageFormat        format;
+		std::vector<uchar> data;
+	};
+	std::vector<Input> inputs;
+	std::error_code error;
+	for (const auto& entry :
+	     std::filesystem::directory_iterator(directory, error)) {
+		Input input;
+		// Empty files can't be decoded by any backend.
+		if (entry.is_regular_file() &&
+			read_file(entry.path().string(), &input.data) &&
+			!input.data.empty()) {
+			input.format = detect_format(input.data);
+			inputs.push_back(std::move(input));
+		}
+	}
+	if (inputs.empty()) {
+		std::cerr << "No images found in " << directory << std::endl;
+		return false;
+	}
+
+	struct Mode {
+		const char*    name;
+		DecoderBackend backend;
+		bool           reduce;
+	};
+	const Mode modes[] = {
+		{"opencv (full size)", DecoderBackend::kOpenCV,    false},
+		{"opencv",             DecoderBackend::kOpenCV,    true},
+		{"turbojpeg",          DecoderBackend::kTurboJpeg, true},
+		{"stb",                DecoderBackend::kStb,       false},
+	};
+
+	std::cout << "Decoder benchmark: " << inputs.size() << " files decoded "
+	          << "from memory and scaled to " << output.width << "x"
+	          << output.height << ", best of " << kBenchmarkRuns << " runs."
+	          << std::endl;
+	std::cout << "Format  Backend              Images   Avg (ms)"
+	          << "   Decoded (MP)   Speedup" << std::endl;
+
+	for (ImageFormat format : {ImageFormat::kJpeg, ImageFormat::kPng,
+	                           ImageFormat::kBmp, ImageFormat::kGif,
+	                           ImageFormat::kOther}) {
+		// The first row of each format, OpenCV at full size, is the baseline.
+		double baseline_ms = 0.0;
+		for (const Mode& mode : modes) {
+			if (!decoder_backend_available(mode.backend) ||
+				!backend_supports(mode.backend, format))
+				continue;
+			// Reduced decode only differs from full size decode for JPEG.
+			if (mode.reduce && mode.backend == DecoderBackend::kOpenCV &&
+				format != ImageFormat::kJpeg)
+				continue;
+
+			int images = 0;
+			double total_ms = 0.0, total_mp = 0.0;
+			for (const Input& input : inputs) {
+				if (input.format != format)
+					continue;
+
+				double best_ms = 0.0;
+				cv::Mat image;
+				for (int run = 0; run < kBenchmarkRuns; ++run) {
+					auto start = std::chrono::steady_clock::now();
+					if (decode_with(mode.backend, input.data, format, output,
+					                mode.reduce, &image) != mode.backend ||
+						image.empty()) {
+						image.release();
+						break;
+					}
+					fit_to_output(image, output);
+					double ms = milliseconds(
+						std::chrono::steady_clock::now() - start).count();
+					best_ms = run == 0 ? ms : (std::min)(best_ms, ms);
+				}
+				if (image.empty())
+					continue;
+				images++;
+				total_ms += best_ms;
+				total_mp += image.total() / 1e6;
+			}
+			if (images == 0)
+				continue;
+
+			double avg_ms = total_ms / images;
+			if (baseline_ms == 0.0)
+				baseline_ms = avg_ms;
+			std::cout << std::left << std::setw(8) << format_name(format)
+			          << std::setw(21) << mode.name << std::right
+			          << std::setw(6) << images
+			          << std::fixed << std::setprecision(2)
+			          << std::setw(11) << avg_ms
+			          << std::setw(15) << total_mp / images
+			          << std::setw(10) << baseline_ms / avg_ms
+			          << std::defaultfloat << std::endl;
+		}
+	}
+	return true;
+}
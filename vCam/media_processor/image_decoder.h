@@ -0,0 +1,72 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+// image_decoder.h
+
+#pragma once
+
+#ifndef IMAGE_DECODER_H
+#define IMAGE_DECODER_H
+
+#include <cstdint>
+#include <string>
+
+#include <opencv2/core.hpp>
+
+// Decoder backends for image sequences. turbojpeg and stb_image are only
+// available when built with TURBOJPEG_ENABLED / STB_ENABLED; OpenCV is the
+// fallback for anything the selected backend can't decode.
+enum class DecoderBackend {
+	kAuto,
+	kOpenCV,
+	kTurboJpeg,
+	kStb,
+};
+
+bool parse_decoder_backend(const std::string& name, DecoderBackend* backend);
+const char* decoder_backend_name(DecoderBackend backend);
+bool decoder_backend_available(DecoderBackend backend);
+
+// Largest libjpeg DCT scaling denominator (1, 2, 4 or 8) at which an image
+// of the given size still covers its letterboxed size within output.
+int reduced_scale(cv::Size image, cv::Size output);
+
+// Scale an image into the center of a black output-sized frame, keeping its
+// aspect ratio. Returns the image itself if it already has the output size.
+cv::Mat fit_to_output(const cv::Mat& image, cv::Size output);
+
+// Decodes images and letterboxes them to the output size.
+//
+// With kAuto the backend is picked per format from the file signature:
+// JPEG goes to turbojpeg, or OpenCV's IMREAD_REDUCED_COLOR_* modes without
+// it, GIF to stb_image and everything else to OpenCV. JPEGs are decoded at
+// the smallest DCT scale that still covers the output, read from the SOF
+// header, so a 24 MP photo shown at 1280x720 is decoded at 1/4 size.
+class ImageDecoder {
+ public:
+	// Returns false if the backend is not compiled in.
+	bool init(DecoderBackend backend, cv::Size output);
+
+	// Decode an image file into an output-sized BGR frame. Returns an empty
+	// Mat if it can't be decoded.
+	cv::Mat decode(const std::string& path);
+
+	void print_report() const;
+
+ private:
+	struct Stats {
+		uint64_t images = 0;
+		double   total_ms = 0.0;
+		double   max_ms = 0.0;
+		double   decoded_pixels = 0.0;
+		double   source_pixels = 0.0;
+	};
+
+	DecoderBackend backend_ = DecoderBackend::kAuto;
+	cv::Size       output_;
+	Stats          stats_[4];
+};
+
+// Decode every image in directory with each available backend and print
+// the average time per format. Returns false if there was nothing to decode.
+bool run_decoder_benchmark(const std::string& directory, cv::Size output);
+
+#endif  // IMAGE_DECODER_H
@@ -0,0 +1,308 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+
+#include "latency_probe.h"  // NOLINT(build/include_subdir)
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <chrono>  // NOLINT(build/c++11)
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace {
+
+// The marker is a grid of black/white cells laid out for the 1280x720 output
+// frame. Cells are large enough to survive the scaling and chroma subsampling
+// a camera application may apply.
+const int kOutputWidth = 1280;
+const int kCellSize = 16;
+const int kMarkerCols = 16;
+const int kMarkerRows = 6;
+const uint32_t kSyncWord = 0xA55A;
+
+// One bucket per millisecond, the last one collects everything above.
+const int kHistogramBuckets = 1000;
+
+// Sequence numbers below the highest one that are still tracked, so a late
+// frame can be told apart from a repeated one. 1024 frames is 17 s at 60 fps.
+const uint32_t kSequenceWindow = 1024;
+
+struct ProbeStats {
+	std::vector<uint64_t> histogram =
+		std::vector<uint64_t>(kHistogramBuckets + 1, 0);
+	uint64_t samples = 0;
+	double   sum_ms = 0.0;
+	double   min_ms = 0.0;
+	double   max_ms = 0.0;
+	uint64_t frames_read = 0;
+	uint64_t unmarked = 0;
+	uint64_t dropped = 0;
+	uint64_t duplicated = 0;
+	uint64_t reordered = 0;
+	bool     have_sequence = false;
+	uint32_t highest_sequence = 0;
+	// Bit sequence % kSequenceWindow is set once that sequence was read.
+	std::bitset<kSequenceWindow> seen;
+};
+
+cv::VideoCapture probe_capture;
+std::thread probe_thread;
+std::atomic<bool> probe_stop(false);
+// Only touched by the reader thread until it has been joined.
+ProbeStats probe_stats;
+
+// Microsecond clock shared by the stamping and the reading side. Truncated to
+// 32 bits; latencies are computed with wrap-around arithmetic.
+uint32_t probe_clock_us() {
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return static_cast<uint32_t>(
+		std::chrono::duration_cast<std::chrono::microseconds>(now).count());
+}
+
+uint32_t marker_checksum(uint32_t sequence, uint32_t timestamp_us) {
+	uint32_t x = (sequence * 0x9E3779B1u) ^ timestamp_us ^ kSyncWord;
+	return (x ^ (x >> 16)) & 0xFFFF;
+}
+
+cv::Rect marker_cell(int bit, double scale) {
+	int cell = static_cast<int>(kCellSize * scale);
+	return cv::Rect(static_cast<int>((bit % kMarkerCols) * kCellSize * scale),
+	                static_cast<int>((bit / kMarkerCols) * kCellSize * scale),
+	                cell, cell);
+}
+
+// Upper bound (ms) of the bucket holding the given fraction of the samples.
+double histogram_percentile(const ProbeStats& stats, double fraction) {
+	uint64_t target = static_cast<uint64_t>(fraction * stats.samples);
+	uint64_t seen = 0;
+	for (int i = 0; i < kHistogramBuckets; ++i) {
+		seen += stats.histogram[i];
+		if (seen > target)
+			return i + 1;
+	}
+	return stats.max_ms;
+}
+
+void record_frame(const cv::Mat& frame, uint32_t now_us) {
+	ProbeStats& stats = probe_stats;
+	stats.frames_read++;
+
+	uint32_t sequence, timestamp_us;
+	if (!decode_probe_marker(frame, &sequence, &timestamp_us)) {
+		stats.unmarked++;
+		return;
+	}
+
+	// The camera may deliver the same frame several times; only the first
+	// sighting of a sequence number measures its latency. A sequence below
+	// the highest one seen so far that hasn't been read yet arrived late: it
+	// was counted as a gap when the later frame showed up, so move it from
+	// dropped to reordered. One that was read already, or that is too old to
+	// tell, is a repeat. The highest sequence is never rewound, otherwise
+	// every frame after a late one would be counted twice.
+	if (stats.have_sequence) {
+		if (sequence <= stats.highest_sequence) {
+			uint32_t age = stats.highest_sequence - sequence;
+			size_t bit = sequence % kSequenceWindow;
+			if (age >= kSequenceWindow || stats.seen[bit]) {
+				stats.duplicated++;
+				return;
+			}
+			stats.seen[bit] = true;
+			stats.reordered++;
+			stats.dropped--;
+		} else {
+			uint32_t advance = sequence - stats.highest_sequence;
+			// Forget the sequences that fall out of the window.
+			if (advance >= kSequenceWindow) {
+				stats.seen.reset();
+			} else {
+				for (uint32_t i = 1; i <= advance; ++i)
+					stats.seen[(stats.highest_sequence + i) % kSequenceWindow] =
+						false;
+			}
+			stats.seen[sequence % kSequenceWindow] = true;
+			stats.dropped += advance - 1;
+			stats.highest_sequence = sequence;
+		}
+	} else {
+		// Sequences before the first one read were never counted as gaps.
+		stats.have_sequence = true;
+		stats.highest_sequence = sequence;
+		stats.seen.set();
+	}
+
+	double latency_ms = static_cast<uint32_t>(now_us - timestamp_us) / 1000.0;
+	int bucket = static_cast<int>(latency_ms);
+	stats.histogram[bucket < kHistogramBuckets ? bucket : kHistogramBuckets]++;
+	stats.min_ms = stats.samples ? (std::min)(stats.min_ms, latency_ms)
+	                             : latency_ms;
+	stats.max_ms = (std::max)(stats.max_ms, latency_ms);
+	stats.sum_ms += latency_ms;
+	stats.samples++;
+}
+
+void probe_reader() {
+	cv::Mat frame;
+	while (!probe_stop) {
+		if (!probe_capture.read(frame)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			continue;
+		}
+		record_frame(frame, probe_clock_us());
+	}
+}
+
+void print_probe_report(const ProbeStats& stats) {
+	std::cout << std::endl << "Latency probe:" << std::endl;
+	std::cout << "Frames read:           " << stats.frames_read << std::endl;
+	std::cout << "Frames without marker: " << stats.unmarked << std::endl;
+	std::cout << "Latency samples:       " << stats.samples << std::endl;
+	std::cout << "Dropped sequences:     " << stats.dropped << std::endl;
+	std::cout << "Duplicated frames:     " << stats.duplicated << std::endl;
+	std::cout << "Reordered frames:      " << stats.reordered << std::endl;
+	if (stats.samples == 0)
+		return;
+
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "Latency (ms):          min " << stats.min_ms
+	          << " / avg " << stats.sum_ms / stats.samples
+	          << " / p50 " << histogram_percentile(stats, 0.50)
+	          << " / p90 " << histogram_percentile(stats, 0.90)
+	          << " / p99 " << histogram_percentile(stats, 0.99)
+	          << " / max " << stats.max_ms << std::endl;
+
+	uint64_t peak = 0;
+	for (uint64_t count : stats.histogram)
+		peak = (std::max)(peak, count);
+
+	std::cout << "Latency histogram (ms):" << std::endl;
+	for (int i = 0; i <= kHistogramBuckets; ++i) {
+		if (stats.histogram[i] == 0)
+			continue;
+		std::string label = i < kHistogramBuckets
+			? std::to_string(i) + "-" + std::to_string(i + 1)
+			: ">=" + std::to_string(kHistogramBuckets);
+		std::cout << std::setw(10) << label << " "
+		          << std::string(static_cast<size_t>(
+		                 50 * stats.histogram[i] / peak), '#')
+		          << " " << stats.histogram[i] << std::endl;
+	}
+}
+
+}  // namespace
+
+void stamp_probe_marker(cv::Mat& frame, uint32_t sequence) {  // NOLINT
+	if (frame.cols < kMarkerCols * kCellSize ||
+		frame.rows < kMarkerRows * kCellSize)
+		return;
+
+	uint32_t timestamp_us = probe_clock_us();
+	int bit = 0;
+	auto put = [&](uint32_t value, int count) {
+		for (int i = count - 1; i >= 0; --i, ++bit) {
+			frame(marker_cell(bit, 1.0)).setTo((value >> i) & 1
+				? cv::Scalar(255, 255, 255) : cv::Scalar(0, 0, 0));
+		}
+	};
+	put(kSyncWord, 16);
+	put(sequence, 32);
+	put(timestamp_us, 32);
+	put(marker_checksum(sequence, timestamp_us), 16);
+}
+
+bool decode_probe_marker(const cv::Mat& frame,
+                         uint32_t* sequence,
+                         uint32_t* timestamp_us) {
+	if (frame.empty() || frame.depth() != CV_8U)
+		return false;
+
+	double scale = static_cast<double>(frame.cols) / kOutputWidth;
+	if (kCellSize * scale < 3 ||
+		frame.rows < kMarkerRows * kCellSize * scale)
+		return false;
+
+	// Average a 3x3 patch around each cell center to ride out compression
+	// noise, then threshold at mid grey.
+	int channels = frame.channels();
+	int bit = 0;
+	auto get = [&](int count) {
+		uint32_t value = 0;
+		for (int i = 0; i < count; ++i, ++bit) {
+			cv::Rect cell = marker_cell(bit, scale);
+			int cx = cell.x + cell.width / 2;
+			int cy = cell.y + cell.height / 2;
+			int sum = 0;
+			for (int y = cy - 1; y <= cy + 1; ++y) {
+				const uchar* row = frame.ptr<uchar>(y);
+				for (int x = cx - 1; x <= cx + 1; ++x)
+					for (int c = 0; c < channels; ++c)
+						sum += row[x * channels + c];
+			}
+			value = (value << 1) | (sum >= 128 * 9 * channels ? 1u : 0u);
+		}
+		return value;
+	};
+
+	if (get(16) != kSyncWord)
+		return false;
+	uint32_t seq = get(32);
+	uint32_t timestamp = get(32);
+	if (get(16) != marker_checksum(seq, timestamp))
+		return false;
+
+	*sequence = seq;
+	*timestamp_us = timestamp;
+	return true;
+}
+
+bool start_latency_probe(int camera_index) {
+	std::cout << std::endl << "Latency probe: reading camera #"
+	          << camera_index << std::endl;
+
+	if (!probe_capture.open(camera_index, cv::CAP_DSHOW)) {
+		std::cerr << "Failed to open camera " << camera_index
+		          << " for the latency probe." << std::endl;
+		return false;
+	}
+	probe_capture.set(cv::CAP_PROP_FRAME_WIDTH, 1280);
+	probe_capture.set(cv::CAP_PROP_FRAME_HEIGHT, 720);
+
+	probe_stop = false;
+	probe_stats = ProbeStats();
+	probe_thread = std::thread(probe_reader);
+	return true;
+}
+
+bool stop_latency_probe(double budget_ms) {
+	if (!probe_thread.joinable())
+		return budget_ms <= 0;
+
+	probe_stop = true;
+	probe_thread.join();
+	probe_capture.release();
+
+	print_probe_report(probe_stats);
+
+	if (budget_ms <= 0)
+		return true;
+
+	if (probe_stats.samples == 0) {
+		std::cerr << "Latency probe: no marked frames were read back."
+		          << std::endl;
+		return false;
+	}
+
+	double p99 = histogram_percentile(probe_stats, 0.99);
+	if (p99 > budget_ms) {
+		std::cerr << "Latency probe: p99 " << p99 << " ms exceeds budget of "
+		          << budget_ms << " ms." << std::endl;
+		return false;
+	}
+	return true;
+}
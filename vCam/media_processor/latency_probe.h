@@ -0,0 +1,36 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+// latency_probe.h
+
+#pragma once
+
+#ifndef LATENCY_PROBE_H
+#define LATENCY_PROBE_H
+
+#include <cstdint>
+
+#include <opencv2/core.hpp>
+
+// Glass-to-glass latency probe.
+//
+// The consumer stamps a block-coded marker (sync word, sequence number,
+// present timestamp and checksum) into the top-left corner of every frame
+// right before handing it to the driver. A reader thread opens the virtual
+// camera like any other application, decodes the marker from the frames it
+// receives and records the end-to-end latency and sequence gaps.
+
+// Stamp the marker for the given sequence number into a BGR frame.
+void stamp_probe_marker(cv::Mat& frame, uint32_t sequence);  // NOLINT
+
+// Decode a marker. Returns false if the frame carries no valid marker.
+bool decode_probe_marker(const cv::Mat& frame,
+                         uint32_t* sequence,
+                         uint32_t* timestamp_us);
+
+// Start reading the virtual camera back from the given camera index.
+bool start_latency_probe(int camera_index);
+
+// Stop the reader and print the latency histogram and sequence statistics.
+// Returns false if the 99th percentile exceeds budget_ms (0: no budget).
+bool stop_latency_probe(double budget_ms);
+
+#endif  // LATENCY_PROBE_H
@@ -0,0 +1,138 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+
+#include "load_shedder.h"  // NOLINT(build/include_subdir)
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// Frames per evaluation window.
+const int kWindowFrames = 30;
+// Shed a level when more than this share of a window missed its deadline.
+const double kMaxMissRatio = 0.1;
+// Restore a level after this many consecutive windows without misses.
+const int kRecoveryWindows = 4;
+// Queue depth at which the producer is considered to keep up. Shedding its
+// work doesn't help when the backlog is already there.
+const double kHealthyQueueDepth = 2.0;
+// Keep the report readable on long runs.
+const size_t kMaxTransitions = 64;
+
+const char* level_name(int level) {
+	switch (level) {
+	case 0:  return "full quality";
+	case 1:  return "drop late frames";
+	case 2:  return "convert 1/2";
+	case 3:  return "convert 1/3";
+	default: return "convert 1/4";
+	}
+}
+
+}  // namespace
+
+void LoadShedder::reset() {
+	window_frames_ = 0;
+	window_misses_ = 0;
+	window_queue_depth_ = 0;
+	clean_windows_ = 0;
+}
+
+void LoadShedder::on_frame_presented(double lateness_ms,
+                                     size_t queue_depth,
+                                     double frame_duration_ms) {
+	// Half a frame late is visible as judder.
+	if (lateness_ms > frame_duration_ms / 2) {
+		window_misses_++;
+		deadline_misses_++;
+	}
+	window_queue_depth_ += queue_depth;
+	if (++window_frames_ < kWindowFrames)
+		return;
+
+	double miss_ratio = static_cast<double>(window_misses_) / window_frames_;
+	double queue_depth_avg =
+		static_cast<double>(window_queue_depth_) / window_frames_;
+	int level = level_;
+
+	if (miss_ratio > kMaxMissRatio) {
+		clean_windows_ = 0;
+		// With a healthy backlog the producer isn't the bottleneck, so only
+		// dropping late frames is worth it.
+		int max_level = queue_depth_avg >= kHealthyQueueDepth ? 1 : kMaxLevel;
+		if (level < max_level) {
+			std::ostringstream reason;
+			reason << window_misses_ << "/" << window_frames_
+			       << " deadlines missed, queue depth "
+			       << std::fixed << std::setprecision(1) << queue_depth_avg;
+			change_level(level + 1, reason.str());
+			escalations_++;
+		}
+	} else if (window_misses_ == 0 && level > 0) {
+		if (++clean_windows_ >= kRecoveryWindows) {
+			clean_windows_ = 0;
+			change_level(level - 1, "on time for " +
+				std::to_string(kRecoveryWindows * kWindowFrames) + " frames");
+			recoveries_++;
+		}
+	} else {
+		clean_windows_ = 0;
+	}
+
+	window_frames_ = 0;
+	window_misses_ = 0;
+	window_queue_depth_ = 0;
+}
+
+bool LoadShedder::should_drop(double lateness_ms,
+                              size_t queue_depth,
+                              double frame_duration_ms) {
+	if (level_ < 1 || queue_depth == 0 || lateness_ms <= frame_duration_ms)
+		return false;
+
+	late_frames_dropped_++;
+	return true;
+}
+
+int LoadShedder::decimation() const {
+	int level = level_;
+	return level >= 2 ? level : 1;
+}
+
+std::string LoadShedder::status() const {
+	std::ostringstream status;
+	status << "level " << level_ << " (" << level_name(level_) << "), missed "
+	       << deadline_misses_ << ", dropped " << late_frames_dropped_
+	       << ", decimated " << frames_decimated_
+	       << ", repeated " << cached_repeats_;
+	return status.str();
+}
+
+void LoadShedder::print_report() const {
+	std::cout << std::endl << "Load shedding:" << std::endl;
+	std::cout << "Deadline misses:       " << deadline_misses_ << std::endl;
+	std::cout << "Late frames dropped:   " << late_frames_dropped_ << std::endl;
+	std::cout << "Frames decimated:      " << frames_decimated_ << std::endl;
+	std::cout << "Cached frame repeats:  " << cached_repeats_ << std::endl;
+	std::cout << "Escalations:           " << escalations_ << std::endl;
+	std::cout << "Recoveries:            " << recoveries_ << std::endl;
+
+	std::lock_guard<std::mutex> lock(transitions_mtx_);
+	for (const Transition& transition : transitions_) {
+		std::cout << std::fixed << std::setprecision(3) << std::setw(10)
+		          << transition.seconds << " s: " << level_name(transition.from)
+		          << " -> " << level_name(transition.to) << " ("
+		          << transition.reason << ")" << std::endl;
+	}
+}
+
+void LoadShedder::change_level(int level, const std::string& reason) {
+	std::lock_guard<std::mutex> lock(transitions_mtx_);
+	if (transitions_.size() < kMaxTransitions) {
+		std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start_;
+		transitions_.push_back({elapsed.count(), level_, level, reason});
+	}
+	level_ = level;
+}
@@ -0,0 +1,92 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+// load_shedder.h
+
+#pragma once
+
+#ifndef LOAD_SHEDDER_H
+#define LOAD_SHEDDER_H
+
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <vector>
+
+// Adaptive quality controller for the producer/consumer pipeline.
+//
+// The consumer reports how late every frame was presented and how many
+// decoded frames were queued behind it. When deadlines are missed the
+// controller sheds work one level at a time and restores quality once the
+// pipeline has been on time for a while:
+//
+//   level 0: full quality
+//   level 1: drop frames that are already late when a newer one is queued
+//   level 2+: additionally convert and queue only every <level>-th frame,
+//            lowering the output rate to an integer divisor of the source
+//            rate
+//
+// Video frames that are shed are still decoded: OpenCV's grab() decodes the
+// frame and only retrieve() is skipped. Levels 2+ save the color
+// conversion, the copy and the queueing of those frames (and the scaling
+// with --decode-workers); only image sequences skip decoding altogether.
+class LoadShedder {
+ public:
+	static constexpr int kMaxLevel = 4;
+
+	void reset();
+
+	// Consumer side: a frame was presented lateness_ms after its deadline.
+	void on_frame_presented(double lateness_ms,
+	                        size_t queue_depth,
+	                        double frame_duration_ms);
+
+	// Consumer side: whether a frame that is lateness_ms behind should be
+	// skipped in favour of the next queued one.
+	bool should_drop(double lateness_ms,
+	                 size_t queue_depth,
+	                 double frame_duration_ms);
+
+	// Consumer side: the queue ran dry and the last frame was presented again.
+	void on_cached_frame_repeated() { cached_repeats_++; }
+
+	// Producer side: convert and queue only every decimation()-th frame.
+	int  decimation() const;
+	void on_frame_decimated() { frames_decimated_++; }
+
+	int  level() const { return level_; }
+	std::string status() const;
+	void print_report() const;
+
+ private:
+	struct Transition {
+		double      seconds;
+		int         from;
+		int         to;
+		std::string reason;
+	};
+
+	void change_level(int level, const std::string& reason);
+
+	std::atomic<int> level_{0};
+
+	// Evaluation window, only touched by the consumer thread.
+	int    window_frames_ = 0;
+	int    window_misses_ = 0;
+	size_t window_queue_depth_ = 0;
+	int    clean_windows_ = 0;
+
+	std::atomic<uint64_t> deadline_misses_{0};
+	std::atomic<uint64_t> late_frames_dropped_{0};
+	std::atomic<uint64_t> frames_decimated_{0};
+	std::atomic<uint64_t> cached_repeats_{0};
+	std::atomic<uint64_t> escalations_{0};
+	std::atomic<uint64_t> recoveries_{0};
+
+	std::chrono::steady_clock::time_point start_ =
+		std::chrono::steady_clock::now();
+	mutable std::mutex transitions_mtx_;
+	std::vector<Transition> transitions_;
+};
+
+#endif  // LOAD_SHEDDER_H
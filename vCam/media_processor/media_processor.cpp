@@ -12,71 +12,312 @@
 #include <queue>
 #include <mutex>  // NOLINT(build/c++11)
 #include <condition_variable>  // NOLINT(build/c++11)
+#include <chrono>  // NOLINT(build/c++11)
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <ctime>
 
 #pragma comment(lib, "winmm.lib")
 
+#include "filter_chain.h"  // NOLINT(build/include_subdir)
+#include "frame_allocator.h"  // NOLINT(build/include_subdir)
+#include "frame_recorder.h"  // NOLINT(build/include_subdir)
+#include "idle_controller.h"  // NOLINT(build/include_subdir)
+#include "image_decoder.h"  // NOLINT(build/include_subdir)
+#include "latency_probe.h"  // NOLINT(build/include_subdir)
+#include "load_shedder.h"  // NOLINT(build/include_subdir)
+#include "segment_decoder.h"  // NOLINT(build/include_subdir)
+#include "text_overlay.h"  // NOLINT(build/include_subdir)
 #include "../utils/dll_utils.h"
 #include "../utils/console_utils.h"
 #include "../utils/file_utils.h"
+#include "../utils/thread_utils.h"
+#include "../utils/timing_utils.h"
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/core.hpp>
 #include <opencv2/core/utils/logger.hpp>
 
 #if STB_ENABLED
-#define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"  // NOLINT(build/include_subdir)
 #endif
 
-std::queue<cv::Mat> image_queue;
+std::queue<MediaFrame> image_queue;
 std::mutex image_queue_mtx;
 std::condition_variable queueCond;
+std::condition_variable queueSpaceCond;
 std::atomic<bool> stop_flag(false);
 std::atomic<bool> loop_flag(false);
 std::atomic<bool> producer_finished(false);
+std::atomic<bool> first_frame_queued(false);
 std::mutex console_mtx;
-
-double fps = 30;
-double frame_duration = 1000.0 / 30;
+std::mutex monitor_mtx;
+std::condition_variable monitorCond;
+
+// Rate used for image sequences and for videos without usable metadata.
+const double kDefaultFps = 30.0;
+const double kMaxFps = 1000.0;
+// Re-anchor the presentation clock instead of bursting through frames when the
+// consumer falls further behind schedule than this.
+const double kMaxLatenessMs = 500.0;
+// Decode-ahead limit. Producers block once this many frames are queued.
+const size_t kMaxQueuedFrames = 8;
+// How often the driver is asked whether any application is watching.
+const std::chrono::milliseconds kConsumerPollInterval(500);
+
+double fps = kDefaultFps;
+double frame_duration = 1000.0 / kDefaultFps;
 
 ProducerFunction function_pointer = nullptr;
+MediaOptions media_options;
+std::shared_future<bool> sink_ready_future;
+FilterChain filter_chain;
+FrameRecorder frame_recorder;
+IdleController idle_controller;
+ImageDecoder image_decoder;
+SegmentDecoder segment_decoder;
+// Signalled when the pipeline stops, wakes the keyboard command thread.
+HANDLE control_stop_event = nullptr;
+TextOverlay text_overlay;
+LoadShedder load_shedder;
+
+// How late frames are presented relative to their deadline, in 0.1 ms buckets
+// up to 100 ms.
+struct PacingStats {
+	std::vector<uint64_t> histogram = std::vector<uint64_t>(1001, 0);
+	uint64_t frames = 0;
+	double   sum_ms = 0.0;
+	double   max_ms = 0.0;
+
+	void record(double lateness_ms) {
+		lateness_ms = (std::max)(lateness_ms, 0.0);
+		histogram[(std::min)(static_cast<size_t>(lateness_ms * 10),
+		                     histogram.size() - 1)]++;
+		frames++;
+		sum_ms += lateness_ms;
+		max_ms = (std::max)(max_ms, lateness_ms);
+	}
+
+	double percentile(double fraction) const {
+		uint64_t target = static_cast<uint64_t>(fraction * frames);
+		uint64_t seen = 0;
+		for (size_t i = 0; i + 1 < histogram.size(); ++i) {
+			seen += histogram[i];
+			if (seen > target)
+				return (i + 1) / 10.0;
+		}
+		return max_ms;
+	}
+
+	void print_report() const {
+		if (frames == 0)
+			return;
+		std::cout << std::endl << "Pacing jitter:" << std::endl;
+		std::cout << "Frames presented:      " << frames << std::endl;
+		std::cout << "Lateness (ms):         avg " << sum_ms / frames
+		          << " / p50 " << percentile(0.50)
+		          << " / p99 " << percentile(0.99)
+		          << " / max " << max_ms << std::endl;
+	}
+};
+PacingStats pacing_stats;
+
+struct SoakSample {
+	int    minute;
+	size_t working_set;
+	size_t pool_in_use;
+};
+std::vector<SoakSample> soak_samples;
 
 cv::VideoCapture cap;
 
+// Ask every pipeline thread to finish and wake up the ones that are waiting.
+static void stop_pipeline() {
+	stop_flag = true;
+	// Taking each lock orders stop_flag before a waiter's predicate check,
+	// so no wakeup is lost between the check and the wait.
+	{
+		std::lock_guard<std::mutex> lock(image_queue_mtx);
+	}
+	queueCond.notify_all();
+	queueSpaceCond.notify_all();
+	{
+		std::lock_guard<std::mutex> lock(monitor_mtx);
+	}
+	monitorCond.notify_all();
+	idle_controller.interrupt();
+	segment_decoder.interrupt();
+	if (control_stop_event)
+		SetEvent(control_stop_event);
+}
+
+// Sample the working set once a minute, then stop the pipeline.
+static void soak_monitor(int minutes) {
+	for (int minute = 1; minute <= minutes; ++minute) {
+		{
+			std::unique_lock<std::mutex> lock(monitor_mtx);
+			if (monitorCond.wait_for(lock, std::chrono::minutes(1),
+			                      [] { return stop_flag.load(); }))
+				return;
+		}
+
+		size_t working_set, peak_working_set;
+		get_working_set(&working_set, &peak_working_set);
+		soak_samples.push_back(SoakSample{minute, working_set,
+		                                  frame_allocator().bytes_in_use()});
+	}
+	stop_pipeline();
+}
+
+// Idle the pipeline while no application has the virtual camera open. The
+// driver interface has no notification for this, so the count is polled.
+// GetConsumerCount is not exported by the driver in this tree; the option
+// does nothing until the driver adds it.
+static void sink_monitor() {
+	if (!sink_ready_future.get())
+		return;
+	if (GetConsumerCount == nullptr) {
+		std::cerr << "The driver interface doesn't export GetConsumerCount, "
+		          << "--idle-when-unwatched is ignored." << std::endl;
+		return;
+	}
+
+	while (!stop_flag) {
+		idle_controller.set(IdleController::kNoConsumers,
+		                    GetConsumerCount() == 0);
+		std::unique_lock<std::mutex> lock(monitor_mtx);
+		monitorCond.wait_for(lock, kConsumerPollInterval,
+		                     [] { return stop_flag.load(); });
+	}
+}
+
+// Keyboard commands: 'p' or space pauses and resumes playback, 'q' or Esc
+// stops vCam. Blocks on the console input and the stop event.
+static void control_commands() {
+	HANDLE handles[2] = {GetStdHandle(STD_INPUT_HANDLE), control_stop_event};
+	while (WaitForMultipleObjects(2, handles, FALSE, INFINITE) ==
+	       WAIT_OBJECT_0) {
+		INPUT_RECORD input;
+		DWORD count = 0;
+		if (!ReadConsoleInput(handles[0], &input, 1, &count))
+			break;
+		if (count == 0 || input.EventType != KEY_EVENT ||
+			!input.Event.KeyEvent.bKeyDown)
+			continue;
+
+		switch (input.Event.KeyEvent.wVirtualKeyCode) {
+		case 'P':
+		case VK_SPACE:
+			idle_controller.toggle(IdleController::kCommand);
+			break;
+		case 'Q':
+		case VK_ESCAPE:
+			stop_pipeline();
+			return;
+		}
+	}
+}
+
+static void print_playback_state() {
+	std::lock_guard<std::mutex> lock(console_mtx);
+	gotoxy(0, console_height - 8);
+	std::cout << "\rPlayback:              " << idle_controller.status()
+	          << "          ";
+}
+
+static void print_soak_report() {
+	if (soak_samples.empty())
+		return;
+
+	std::cout << std::endl << "Soak test:" << std::endl;
+	std::cout << "Minute   Working set (MB)   Frame pool in use (MB)" << std::endl;
+	for (const SoakSample& sample : soak_samples) {
+		std::cout << std::setw(6) << sample.minute
+		          << std::setw(19) << sample.working_set / (1024.0 * 1024.0)
+		          << std::setw(25) << sample.pool_in_use / (1024.0 * 1024.0)
+		          << std::endl;
+	}
+	double growth = (static_cast<double>(soak_samples.back().working_set) -
+		static_cast<double>(soak_samples.front().working_set)) / (1024.0 * 1024.0);
+	std::cout << "Working set growth:    " << growth << " MB" << std::endl;
+}
+
 int start_media_processing(const std::string& media_type,
                            const std::string& media_path,
                            bool loop,
-                           bool detailed_logging) {
+                           bool detailed_logging,
+                           const MediaOptions& options,
+                           std::shared_future<bool> sink_ready) {
 	std::string valid_media_path = validate_media_path(media_type, media_path);
 	if (valid_media_path.empty())
-		return 1;
+		return 0;
+	mark_startup_phase("Media path validated");
 
 	get_console_height();
 	loop_flag = loop;
+	media_options = options;
+	sink_ready_future = sink_ready;
 
 	if (!detailed_logging)
 		cv::utils::logging::setLogLevel(
 			cv::utils::logging::LogLevel::LOG_LEVEL_SILENT);
 
+	// Install the frame pool before the first frame is decoded. Enough
+	// output-sized buffers for a full queue plus the frames in flight, and
+	// the queues of the segment decode workers.
+	if (media_options.frame_pool) {
+		int worker_frames = media_options.decode_workers > 1 ?
+			media_options.decode_workers * SegmentDecoder::max_queued_frames(
+				media_options.segment_frames) : 0;
+		frame_allocator().reserve(1280 * 720 * 3,
+			static_cast<int>(kMaxQueuedFrames) + 8 + worker_frames,
+			numa_node_for_affinity(media_options.consumer_thread.affinity_mask));
+		cv::Mat::setDefaultAllocator(&frame_allocator());
+	}
+
 	if (media_type == "-v") {
 		function_pointer = producer_video;
 		//  Create a VideoCapture object and open the video file.
-		cap.open(valid_media_path);
+		open_video(&cap, valid_media_path, media_options.decode_threads);
 
 		if (!cap.isOpened()) {
 			std::cerr << "Failed to open video file: " << valid_media_path << std::endl;
 			return 0;
 		}
+		mark_startup_phase("Video opened");
 
-		//  Get the frame rate of the video.
+		//  Get the nominal frame rate of the video. It is only used as a fallback
+		//  when a frame carries no usable presentation timestamp.
 		fps = cap.get(cv::CAP_PROP_FPS);
-		if (fps <= 0) {
-			std::cerr << "Failed to get video frame rate." << std::endl;
+		if (!(fps > 0 && fps <= kMaxFps)) {
+			std::cerr << "Failed to get video frame rate, assuming "
+			          << kDefaultFps << " fps." << std::endl;
+			fps = kDefaultFps;
 		}
 
 		frame_duration = 1000.0 / fps;
+
+		std::cout << "Video decoder:         " << cap.getBackendName() << ", "
+		          << cap.get(cv::CAP_PROP_N_THREADS) << " threads" << std::endl;
+
+		// Decode segments of the video on several cores instead.
+		if (media_options.decode_workers > 1) {
+			cap.release();
+			function_pointer = producer_video_parallel;
+			if (!segment_decoder.open(valid_media_path,
+			                          media_options.decode_workers,
+			                          media_options.segment_frames,
+			                          media_options.decode_threads,
+			                          cv::Size(1280, 720), frame_duration,
+			                          loop_flag, &load_shedder))
+				return 0;
+			mark_startup_phase("Video segments planned");
+		}
 	} else if (media_type == "-i") {
 		function_pointer = producer_image;
+		if (!image_decoder.init(media_options.decoder, cv::Size(1280, 720)))
+			return 0;
 	} else {
 		std::cerr << "Invalid input type: " << media_type << std::endl;
 		return 0;
@@ -87,30 +328,161 @@ int start_media_processing(const std::string& media_type,
 	std::cout << "========================= frame_duration: " << frame_duration;
 #endif
 
-	std::thread producerThread(function_pointer, valid_media_path);
-	std::thread consumerThread(consumer);
+	if (!filter_chain.init(media_options))
+		return 0;
+
+	if (!media_options.record_path.empty() &&
+		!frame_recorder.open(media_options.record_path))
+		return 0;
+
+	// The probe reads the virtual camera back, so it needs the device first.
+	if (media_options.probe_camera >= 0 &&
+		(!sink_ready_future.get() ||
+		 !start_latency_probe(media_options.probe_camera)))
+		return 0;
+
+	if (media_options.overlay)
+		text_overlay.init(2, 64);
+
+	apply_process_config(media_options.priority_class,
+	                     media_options.locked_memory_mb);
+	// The raised minimum alone doesn't keep pages resident; pin the frame
+	// pool, which holds every frame in flight.
+	if (media_options.locked_memory_mb != 0 && media_options.frame_pool)
+		frame_allocator().lock_slab();
+	if (media_options.stress_threads > 0)
+		start_cpu_stress(media_options.stress_threads);
+
+	idle_controller.start();
+
+	std::thread producerThread([&valid_media_path]() {
+		ScopedThreadConfig placement("producer", media_options.producer_thread);
+		function_pointer(valid_media_path);
+	});
+	std::thread consumerThread([]() {
+		ScopedThreadConfig placement("consumer", media_options.consumer_thread);
+		consumer();
+	});
+	std::thread soakThread;
+	if (media_options.soak_minutes > 0)
+		soakThread = std::thread(soak_monitor, media_options.soak_minutes);
+	std::thread sinkThread;
+	if (media_options.idle_when_unwatched)
+		sinkThread = std::thread(sink_monitor);
+	std::thread controlThread;
+	DWORD console_mode;
+	if (GetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), &console_mode)) {
+		control_stop_event = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+		if (control_stop_event)
+			controlThread = std::thread(control_commands);
+	}
 
 	producerThread.join();
 	consumerThread.join();
 
+	// Wake up the monitor threads.
+	stop_pipeline();
+	if (sinkThread.joinable())
+		sinkThread.join();
+	if (controlThread.joinable())
+		controlThread.join();
+	if (control_stop_event) {
+		CloseHandle(control_stop_event);
+		control_stop_event = nullptr;
+	}
+	segment_decoder.close();
+	if (soakThread.joinable()) {
+		soakThread.join();
+		print_soak_report();
+	}
+
+	if (media_options.stress_threads > 0)
+		stop_cpu_stress();
+
+	bool recording_ok = frame_recorder.close();
+
+	print_startup_report();
+	print_thread_report();
+	pacing_stats.print_report();
+	load_shedder.print_report();
+	idle_controller.print_report();
+
+	if (media_options.frame_pool)
+		frame_allocator().print_report();
+
+	image_decoder.print_report();
+	segment_decoder.print_report();
+	filter_chain.print_report();
+
+	if (media_options.overlay)
+		text_overlay.print_report();
+
+	frame_recorder.print_report();
+	if (recording_ok && !media_options.verify_path.empty())
+		recording_ok = verify_recording(media_options.verify_path,
+		                                media_options.record_path,
+		                                media_options.timing_tolerance_ms);
+
+	if (media_options.probe_camera >= 0 &&
+		!stop_latency_probe(media_options.probe_budget_ms))
+		return 0;
+
+	if (!recording_ok)
+		return 0;
+
+	if (!sink_ready_future.get())
+		return 0;
+
 	return 1;
 }
 
+// Queue a decoded frame, waiting while the decode-ahead limit is reached.
+// Returns false if the pipeline is stopping.
+static bool push_frame(MediaFrame&& frame) {
+	{
+		std::unique_lock<std::mutex> lock(image_queue_mtx);
+		queueSpaceCond.wait(lock, [] {
+			return stop_flag || image_queue.size() < kMaxQueuedFrames;
+		});
+		if (stop_flag)
+			return false;
+		image_queue.push(std::move(frame));
+	}
+	// Notify the consumer thread that a new image has arrived
+	queueCond.notify_one();
+
+	if (!first_frame_queued.exchange(true))
+		mark_startup_phase("First frame decoded");
+	return true;
+}
+
 void producer_video(const std::string& video_file) {
+	std::string source = std::filesystem::path(video_file).filename().string();
 	int frames = 0;
 	int iteration = 1;
+	double last_pts = 0.0;
 	while (!stop_flag) {
-		// Loop through reading each frame of the video
+		// Nothing is decoded while the pipeline idles.
+		if (idle_controller.wait_while_idle(stop_flag))
+			continue;
+
+		// Loop through reading each frame of the video. Under load only every
+		// decimation-th frame is retrieved; grab() still decodes the others,
+		// but skips their color conversion and copy.
+		int decimation = load_shedder.decimation();
+		bool skip = decimation > 1 && frames % decimation != 0;
 		cv::Mat frame;
-		if (!cap.read(frame)) {
+		if (skip ? !cap.grab() : !cap.read(frame)) {
 			// Unable to read next frame: end of video or error.
 			if (loop_flag) {
 				// Reset the video frame position to the beginning of the video
 				while (!image_queue.empty() && !stop_flag) {
+					idle_controller.wait_while_idle(stop_flag);
 					std::this_thread::sleep_for(std::chrono::milliseconds(20));
 				}
 				cap.set(cv::CAP_PROP_POS_FRAMES, 0);
 				frames = 0;  // Reset the frame counter
+				last_pts = 0.0;
 				iteration++;
 				continue;
 			} else {
@@ -119,11 +491,28 @@ void producer_video(const std::string& video_file) {
 			}
 		}
 
-		// Put the frame into the queue
-        {
-			std::lock_guard<std::mutex> lock(image_queue_mtx);
-			image_queue.push(frame.clone());  // Use cloning to avoid concurrency issues
+		// Presentation timestamp of the frame just read. Variable-frame-rate
+		// sources only play in real time when scheduled by their own PTS; fall
+		// back to the nominal rate when the container doesn't provide one.
+		double pts = cap.get(cv::CAP_PROP_POS_MSEC);
+		if (frames == 0) {
+			if (!(pts >= 0))
+				pts = 0.0;
+		} else if (!(pts > last_pts)) {
+			pts = last_pts + frame_duration;
 		}
+		last_pts = pts;
+
+		if (skip) {
+			frames++;
+			load_shedder.on_frame_decimated();
+			continue;
+		}
+
+		// Put the frame into the queue. Use cloning to avoid concurrency issues
+		if (!push_frame(MediaFrame{frame.clone(), pts, source,
+		                           frames + 1, iteration}))
+			break;
 
 		frames++;
 		std::lock_guard<std::mutex> lock(console_mtx);
@@ -134,9 +523,6 @@ void producer_video(const std::string& video_file) {
 		gotoxy(0, console_height - 5);
 		std::cout << "\rFrame # (Decoded):     " << frames;
 
-		// Notify the consumer thread that a new image has arrived
-		queueCond.notify_one();
-
 		// Pause for a while before continuing to read the new frame
 		// std::this_thread::sleep_for(std::chrono::milliseconds(100));
 	}
@@ -144,31 +530,97 @@ void producer_video(const std::string& video_file) {
 	producer_finished = true;
 }
 
+// Like producer_video, with the frames decoded by the segment workers and
+// handed out in presentation order. The workers apply the decimation, so
+// frames that are shed are never scaled or queued.
+void producer_video_parallel(const std::string& video_file) {
+	int frames = 0;
+	int iteration = 1;
+	double last_pts = 0.0;
+	MediaFrame frame;
+	while (!stop_flag) {
+		// Nothing is queued while the pipeline idles, the workers stop once
+		// their queues are full.
+		if (idle_controller.wait_while_idle(stop_flag))
+			continue;
+		if (!segment_decoder.read(&frame))
+			break;
+
+		if (frame.iteration != iteration) {
+			// The workers wrapped around to the start of the video.
+			iteration = frame.iteration;
+			frames = 0;
+			last_pts = 0.0;
+		}
+		if (frames == 0) {
+			if (!(frame.pts >= 0))
+				frame.pts = 0.0;
+		} else if (!(frame.pts > last_pts)) {
+			frame.pts = last_pts + frame_duration;
+		}
+		last_pts = frame.pts;
+
+		// Decimated frames are missing from the sequence but still counted.
+		int frame_number = frame.frame_number;
+		if (!push_frame(std::move(frame)))
+			break;
+
+		frames = frame_number;
+		std::lock_guard<std::mutex> lock(console_mtx);
+		if (loop_flag) {
+			gotoxy(0, console_height - 6);
+			std::cout << "\rIteration #:           " << iteration;
+		}
+		gotoxy(0, console_height - 5);
+		std::cout << "\rFrame # (Decoded):     " << frames;
+	}
+
+	producer_finished = true;
+}
+
 void producer_image(const std::string& directory) {
 	int frames = 0;
 	int iteration = 1;
+	double pts = 0.0;
 	while (!stop_flag) {
 		// Generate images and put them into the queue
 		for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+			// Nothing is decoded while the pipeline idles.
+			idle_controller.wait_while_idle(stop_flag);
+			if (stop_flag)
+				break;
 			if (entry.is_regular_file()) {
 				std::string path = entry.path().string();
+
+				// Under load only every decimation-th image is decoded, the
+				// others keep their slot in the timeline.
+				int decimation = load_shedder.decimation();
+				if (decimation > 1 && frames % decimation != 0) {
+					frames++;
+					pts += frame_duration;
+					load_shedder.on_frame_decimated();
+					continue;
+				}
+
+				// Decode and queue outside of the console lock, the consumer
+				// takes it for every frame it presents.
+				cv::Mat image = image_decoder.decode(path);
+				if (!image.empty()) {
+					// Put the image into the queue
+					if (!push_frame(MediaFrame{image, pts,
+					                           entry.path().filename().string(),
+					                           frames + 1, iteration}))
+						break;
+					// Images have no timing of their own, play them at the
+					// default rate.
+					pts += frame_duration;
+				}
+				frames++;
                 {
 					std::lock_guard<std::mutex> console_lock(console_mtx);
 					// Move the cursor to the third line from the bottom of the console
 					gotoxy(0, console_height - 6);
 					std::cout << "\rQueuing image:         " << path << "\n";
-					cv::Mat image = cv::imread(path);
-					if (!image.empty()) {
-						// Put the image into the queue
-                        {
-							std::lock_guard<std::mutex> lock(image_queue_mtx);
-							image_queue.push(image);
-						}
-						// Notify the consumer thread that a new image has arrived
-						// queueCond.notify_one();
-					}
-					frames++;
-					// std::lock_guard<std::mutex> lock(console_mtx);
 					gotoxy(0, console_height - 5);
 					std::cout << "\rFrame # (Decoded):     " << frames;
 					if (loop_flag) {
@@ -183,10 +635,12 @@ void producer_image(const std::string& directory) {
 		if (loop_flag) {
 			// Reset the video frame position to the beginning of the video
 			while (!image_queue.empty() && !stop_flag) {
+				idle_controller.wait_while_idle(stop_flag);
 				std::this_thread::sleep_for(std::chrono::milliseconds(20));
 			}
 			cap.set(cv::CAP_PROP_POS_FRAMES, 0);
 			frames = 0;  // Reset the frame counter
+			pts = 0.0;
 			iteration++;
 			continue;
 		} else {
@@ -201,54 +655,182 @@ void producer_image(const std::string& directory) {
 }
 
 void consumer() {
+	using clock = std::chrono::steady_clock;
+	using milliseconds = std::chrono::duration<double, std::milli>;
+
 	int frames = 0;
+	uint32_t probe_sequence = 0;
+	bool sink_ready = false;
+	// Wall-clock time at which the frame with timestamp anchor_pts is due.
+	// Every later frame is scheduled relative to it, so sleep inaccuracies
+	// don't accumulate into drift.
+	bool anchored = false;
+	clock::time_point anchor_time;
+	double anchor_pts = 0.0;
+	double last_pts = 0.0;
+	clock::time_point last_deadline;
+	// Last presented frame, shown again when the queue runs dry.
+	MediaFrame last_frame;
+	clock::time_point last_present;
+
 	while (!stop_flag) {
 		if (producer_finished && image_queue.empty())
 			break;
 
-		auto loop_start = std::chrono::high_resolution_clock::now();
+		// Block until playback resumes, keeping the last frame. The next
+		// frame is then due right away: idle time is neither caught up on
+		// nor counted as lateness.
+		if (idle_controller.idle()) {
+			print_playback_state();
+			idle_controller.wait_while_idle(stop_flag);
+			if (stop_flag)
+				break;
+			anchored = false;
+			load_shedder.reset();
+			print_playback_state();
+			continue;
+		}
+
+		auto loop_start = clock::now();
 		bool hasData = false;
+		MediaFrame current;
+		size_t queue_depth = 0;
         {
 			std::unique_lock<std::mutex> lock(image_queue_mtx);
+			// Wait up to one frame for the producer instead of polling
+			if (image_queue.empty() && !producer_finished)
+				queueCond.wait_for(lock, milliseconds(frame_duration));
 			if (!image_queue.empty()) {
 				hasData = true;
-				cv::Mat currentImage = image_queue.front();
+				current = std::move(image_queue.front());
 				image_queue.pop();
-				lock.unlock();
-				SetBuffer(currentImage.data,
-					     static_cast<DWORD>(currentImage.step),
-					     1280,
-					     720);
-				frames++;
+				queue_depth = image_queue.size();
 			}
 		}
+		if (hasData)
+			queueSpaceCond.notify_one();
+
+		// The first frame has been decoded while the driver was starting up;
+		// present it as soon as the device is ready.
+		if (hasData && !sink_ready) {
+			if (!sink_ready_future.get()) {
+				std::cerr << "vCam device is not available." << std::endl;
+				stop_pipeline();
+				break;
+			}
+			sink_ready = true;
+			mark_startup_phase("Sink ready");
+			loop_start = clock::now();
+		}
 
-		auto setbuffer_done = std::chrono::steady_clock::now();
-		auto elapsed_time = std::chrono::duration_cast
-						    <std::chrono::milliseconds>(setbuffer_done - loop_start).count();
+		if (hasData) {
+			if (!anchored) {
+				anchored = true;
+				anchor_time = loop_start;
+				anchor_pts = current.pts;
+			} else if (current.pts <= last_pts) {
+				// Timestamps restarted (looping): continue one nominal frame
+				// after the last frame of the previous iteration.
+				anchor_time = (std::max)(loop_start, last_deadline +
+					std::chrono::duration_cast<clock::duration>(
+						milliseconds(frame_duration)));
+				anchor_pts = current.pts;
+			}
 
-		// Calculate remaining waiting time
-		auto remaining_time = static_cast<int64_t>
-			(hasData ? frame_duration - elapsed_time - 1 : fps);
+			auto deadline = anchor_time + std::chrono::duration_cast
+				<clock::duration>(milliseconds(current.pts - anchor_pts));
+
+			// Too far behind schedule: drop the backlog of time rather than
+			// rushing through the following frames.
+			if (milliseconds(loop_start - deadline).count() > kMaxLatenessMs) {
+				anchor_time = loop_start;
+				anchor_pts = current.pts;
+				deadline = loop_start;
+			}
+
+			// Under load, skip frames that are already late when a newer one
+			// is waiting.
+			if (load_shedder.should_drop(milliseconds(loop_start - deadline).count(),
+			                             queue_depth, frame_duration)) {
+				if (frame_recorder.is_open())
+					frame_recorder.on_frame_dropped(current, deadline);
+				last_pts = current.pts;
+				last_deadline = deadline;
+				continue;
+			}
+
+			if (!filter_chain.empty())
+				filter_chain.apply(current.image);
+
+			// Hashed before the overlay and the probe marker, which differ
+			// from run to run, in the slack before the deadline.
+			uint64_t content_hash = frame_recorder.is_open() ?
+				frame_recorder.hash_content(current.image) : 0;
+
+			if (media_options.overlay) {
+				// Stamp the time the frame is going to be presented at.
+				auto present_time = std::chrono::system_clock::now() +
+					std::chrono::duration_cast<std::chrono::system_clock::duration>(
+						deadline - clock::now());
+				text_overlay.stamp(current.image, current.source,
+				                   current.frame_number, current.iteration,
+				                   present_time);
+			}
 
 #if DEBUG == 1
-		std::cout << "elapsed_time: " << elapsed_time << " ms" << std::endl;
-		std::cout << "frame_duration: " << frame_duration << " ms" << std::endl;
-		std::cout << "remaining: " << remaining_time << " ms" << std::endl;
+			std::cout << "pts: " << current.pts << " ms" << std::endl;
+			std::cout << "remaining: "
+			          << milliseconds(deadline - loop_start).count()
+			          << " ms" << std::endl;
 #endif
 
-		timeBeginPeriod(1);
-		// Wait for the remaining time
-		if (remaining_time > 0)
-			std::this_thread::sleep_for(std::chrono::milliseconds(remaining_time));
-		timeEndPeriod(1);
+			// Wait until the frame is due
+			timeBeginPeriod(1);
+			std::this_thread::sleep_until(deadline);
+			timeEndPeriod(1);
+
+			if (media_options.probe_camera >= 0)
+				stamp_probe_marker(current.image, probe_sequence++);
+
+			SetBuffer(current.image.data,
+				     static_cast<DWORD>(current.image.step),
+				     1280,
+				     720);
+			last_present = clock::now();
+			double lateness = milliseconds(last_present - deadline).count();
+			pacing_stats.record(lateness);
+			load_shedder.on_frame_presented(lateness, queue_depth,
+			                                frame_duration);
+			if (frame_recorder.is_open())
+				frame_recorder.on_frame_presented(current, content_hash,
+				                                  deadline, last_present);
+			if (frames++ == 0)
+				mark_startup_phase("First frame presented");
+			last_pts = current.pts;
+			last_deadline = deadline;
+			last_frame = current;
+		} else if (!last_frame.image.empty() &&
+			milliseconds(clock::now() - last_present).count() >= frame_duration) {
+			// The producer fell behind: keep the sink fed with the last frame.
+			SetBuffer(last_frame.image.data,
+				     static_cast<DWORD>(last_frame.image.step),
+				     1280,
+				     720);
+			last_present = clock::now();
+			load_shedder.on_cached_frame_repeated();
+			if (frame_recorder.is_open())
+				frame_recorder.on_frame_repeated(last_frame, last_present);
+		}
 
-		auto loop_end = std::chrono::high_resolution_clock::now();
+		auto loop_end = clock::now();
 		auto loop_duration = std::chrono::duration_cast\
 			                 <std::chrono::milliseconds>(loop_end - loop_start);
 
 		std::lock_guard<std::mutex> lock(console_mtx);
 		double real_fps = 1000.0 / loop_duration.count();
+		gotoxy(0, console_height - 4);
+		std::cout << "\rLoad shedding:         " << load_shedder.status() << "   ";
+
 		// Move the cursor to the third line from the bottom of the console
 		gotoxy(0, console_height - 3);
 		std::cout << "\rFrame # (Consumed):    " << frames;
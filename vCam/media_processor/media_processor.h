@@ -6,16 +6,89 @@
 #ifndef VIDEO_PROCESSING_H
 #define VIDEO_PROCESSING_H
 
+#include <future>  // NOLINT(build/c++11)
 #include <string>
 
+#include <opencv2/core.hpp>
+
+#include "image_decoder.h"  // NOLINT(build/include_subdir)
+#include "../utils/thread_utils.h"
+
+// A decoded frame together with its presentation timestamp (milliseconds,
+// relative to the start of the current iteration of the media) and the
+// producer counters it was decoded with.
+struct MediaFrame {
+	cv::Mat     image;
+	double      pts = 0.0;
+	std::string source;
+	int         frame_number = 0;
+	int         iteration = 0;
+};
+
+// Optional pipeline features selected on the command line.
+struct MediaOptions {
+	// Camera index the latency probe reads the virtual camera back from,
+	// -1 when the probe is disabled.
+	int    probe_camera = -1;
+	// Fail the run when the 99th percentile latency exceeds this (0: no limit).
+	double probe_budget_ms = 0.0;
+	// Burn file name, frame/iteration counters and wall-clock time into frames.
+	bool   overlay = false;
+	// Time the overlay on a synthetic frame instead of playing.
+	bool   overlay_benchmark = false;
+	// Placement and scheduling of the pipeline threads.
+	ThreadConfig producer_thread;
+	ThreadConfig consumer_thread;
+	uint32_t     priority_class = 0;
+	size_t       locked_memory_mb = 0;
+	// Busy threads started next to the pipeline to measure pacing jitter
+	// under CPU contention.
+	int          stress_threads = 0;
+	// Serve frame buffers from the pooled allocator.
+	bool         frame_pool = true;
+	// Stop after this many minutes, sampling the working set once a minute.
+	int          soak_minutes = 0;
+	// Filter chain: color adjustment, chroma key over a background image and
+	// a box blur over a region.
+	double       brightness = 0.0;
+	double       contrast = 1.0;
+	double       gamma = 1.0;
+	std::string  chroma_key_background;
+	cv::Rect     blur_region;
+	int          blur_kernel = 31;
+	// Time each filter on a synthetic frame instead of playing.
+	bool         filter_benchmark = false;
+	// Record presented frames (content hash, scheduled and actual present
+	// time) to this file, then compare the recording with a golden one.
+	std::string  record_path;
+	std::string  verify_path;
+	double       timing_tolerance_ms = 5.0;
+	// Stop decoding while no application has the virtual camera open.
+	bool         idle_when_unwatched = false;
+	// Image decoder backend, and whether to benchmark the backends on the
+	// image directory instead of playing it.
+	DecoderBackend decoder = DecoderBackend::kAuto;
+	bool           decoder_benchmark = false;
+	// Video decoding: backend frame/slice threads per capture (0: backend
+	// default), number of segment workers (1: a single capture), minimum
+	// frames per segment, and whether to benchmark ingest instead of playing.
+	int            decode_threads = 0;
+	int            decode_workers = 1;
+	int            segment_frames = 32;
+	bool           ingest_benchmark = false;
+};
+
 typedef void (*ProducerFunction)(const std::string&);
 
 void producer_video(const std::string& video_file);
+void producer_video_parallel(const std::string& video_file);
 void producer_image(const std::string& directory);
 void consumer();
 int  start_media_processing(const std::string& input_type,
                             const std::string& input_path,
                             bool loop,
-                            bool detailed_logging);
+                            bool detailed_logging,
+                            const MediaOptions& options,
+                            std::shared_future<bool> sink_ready);
 
 #endif  // VIDEO_PROCESSING_H
@@ -0,0 +1,404 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+
+#include "segment_decoder.h"  // NOLINT(build/include_subdir)
+
+#include <algorithm>
+#include <chrono>  // NOLINT(build/c++11)
+#include <climits>
+#include <cmath>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+
+#include <opencv2/opencv.hpp>
+
+#include "frame_recorder.h"  // NOLINT(build/include_subdir)
+#include "image_decoder.h"  // NOLINT(build/include_subdir)
+
+namespace {
+
+using milliseconds = std::chrono::duration<double, std::milli>;
+
+// PTS of a parallel decoded frame and of the same frame decoded
+// sequentially may differ by rounding only.
+const double kPtsToleranceMs = 0.01;
+
+// Keyframe positions from a demux-only pass over the video, empty if the
+// backend can't report them. packets receives the number of video packets.
+std::vector<int> scan_keyframes(const std::string& path, int* packets) {
+	std::vector<int> keyframes;
+	cv::VideoCapture capture;
+	if (!capture.open(path, cv::CAP_FFMPEG, {cv::CAP_PROP_FORMAT, -1}))
+		return keyframes;
+
+	int index = 0;
+	while (capture.grab()) {
+		if (capture.get(cv::CAP_PROP_LRF_HAS_KEY_FRAME) != 0)
+			keyframes.push_back(index);
+		index++;
+	}
+	*packets = index;
+	return keyframes;
+}
+
+}  // namespace
+
+bool open_video(cv::VideoCapture* capture,
+                const std::string& path,
+                int decode_threads) {
+	std::vector<int> params;
+	if (decode_threads > 0)
+		params = {cv::CAP_PROP_N_THREADS, decode_threads};
+	return capture->open(path, cv::CAP_ANY, params);
+}
+
+bool SegmentDecoder::open(const std::string& path,
+                          int workers,
+                          int segment_frames,
+                          int decode_threads,
+                          cv::Size output,
+                          double frame_duration_ms,
+                          bool loop,
+                          LoadShedder* load_shedder) {
+	path_ = path;
+	source_ = std::filesystem::path(path).filename().string();
+	decode_threads_ = decode_threads;
+	output_ = output;
+	frame_duration_ms_ = frame_duration_ms;
+	loop_ = loop;
+	load_shedder_ = load_shedder;
+
+	auto scan_start = std::chrono::steady_clock::now();
+	plan_segments(segment_frames);
+	scan_ms_ = milliseconds(std::chrono::steady_clock::now() -
+	                        scan_start).count();
+	if (segments_.empty()) {
+		std::cerr << "Failed to open video file: " << path << std::endl;
+		return false;
+	}
+	// Room for a whole segment and its end marker.
+	capacity_ = static_cast<size_t>(longest_segment_) + 1;
+
+	// More workers than segments would never get any work. Without an
+	// explicit thread count the processors are shared between the workers.
+	workers = (std::min)(workers, static_cast<int>(segments_.size()));
+	if (decode_threads_ <= 0)
+		decode_threads_ = (std::max)(1,
+			static_cast<int>(std::thread::hardware_concurrency()) / workers);
+	for (int i = 0; i < workers; ++i)
+		workers_.push_back(std::make_unique<Worker>());
+	for (size_t i = 0; i < workers_.size(); ++i)
+		workers_[i]->thread = std::thread(&SegmentDecoder::run_worker, this, i);
+	return true;
+}
+
+void SegmentDecoder::plan_segments(int segment_frames) {
+	// Split at keyframes, so a worker's seek lands on a frame it can decode
+	// right away. There must be enough of them to keep the workers busy.
+	int packets = 0;
+	std::vector<int> keyframes = scan_keyframes(path_, &packets);
+	if (keyframes.size() > 1 && keyframes.front() == 0) {
+		int start = 0;
+		for (int keyframe : keyframes) {
+			if (keyframe - start >= segment_frames) {
+				add_segment(start, keyframe, segment_frames);
+				start = keyframe;
+			}
+		}
+		add_segment(start, (std::max)(start + 1, packets), segment_frames);
+		segments_.back().end = INT_MAX;
+		// Split GOPs don't count, each of their pieces but the first starts
+		// between keyframes.
+		keyframe_aligned_ =
+			static_cast<int>(segments_.size()) - split_segments_ > 1;
+		if (keyframe_aligned_)
+			return;
+		segments_.clear();
+		split_segments_ = 0;
+		longest_segment_ = 0;
+	}
+
+	// Fixed-size segments. Seeking then decodes from the preceding keyframe,
+	// and the last segment runs to the end in case the count is off.
+	cv::VideoCapture capture;
+	if (!capture.open(path_))
+		return;
+	int frames = static_cast<int>(capture.get(cv::CAP_PROP_FRAME_COUNT));
+	int start = 0;
+	for (; start + segment_frames < frames; start += segment_frames)
+		segments_.push_back({start, start + segment_frames});
+	segments_.push_back({start, INT_MAX});
+	longest_segment_ = segment_frames;
+}
+
+void SegmentDecoder::add_segment(int start, int end, int segment_frames) {
+	// A GOP too long for the worker queue is split into segment_frames
+	// pieces; the remainder stays with the last one, which keeps every
+	// segment below max_queued_frames().
+	while (end - start > 2 * segment_frames) {
+		segments_.push_back({start, start + segment_frames});
+		start += segment_frames;
+		split_segments_++;
+		longest_segment_ = (std::max)(longest_segment_, segment_frames);
+	}
+	segments_.push_back({start, end});
+	longest_segment_ = (std::max)(longest_segment_, end - start);
+}
+
+void SegmentDecoder::run_worker(size_t index) {
+	Worker& worker = *workers_[index];
+	cv::VideoCapture capture;
+	bool opened = open_video(&capture, path_, decode_threads_);
+
+	// Segment g of the endless sequence is segment g % size of iteration
+	// g / size + 1.
+	const uint64_t count = segments_.size();
+	for (uint64_t g = index; opened && !stop_ && (loop_ || g < count);
+	     g += workers_.size()) {
+		const Segment& segment = segments_[g % count];
+		int iteration = static_cast<int>(g / count) + 1;
+		capture.set(cv::CAP_PROP_POS_FRAMES, segment.start);
+
+		for (int n = segment.start; n < segment.end && !stop_; ++n) {
+			// Under load only every decimation-th frame of an iteration is
+			// retrieved and scaled, as in producer_video.
+			int decimation = load_shedder_ ? load_shedder_->decimation() : 1;
+			if (decimation > 1 && n % decimation != 0) {
+				if (!capture.grab())
+					break;
+				worker.decimated++;
+				load_shedder_->on_frame_decimated();
+				continue;
+			}
+
+			auto decode_start = std::chrono::steady_clock::now();
+			cv::Mat frame;
+			if (!capture.read(frame))
+				break;
+			double pts = capture.get(cv::CAP_PROP_POS_MSEC);
+			if (!(pts >= 0))
+				pts = n * frame_duration_ms_;
+			cv::Mat image = fit_to_output(frame, output_);
+			worker.decode_ms += milliseconds(std::chrono::steady_clock::now() -
+			                                 decode_start).count();
+			worker.decoded++;
+
+			if (!push(&worker, MediaFrame{image, pts, source_, n + 1,
+			                              iteration}))
+				return;
+		}
+		if (!push(&worker, MediaFrame{cv::Mat(), 0.0, source_, 0, iteration}))
+			return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(worker.mtx);
+		worker.finished = true;
+	}
+	worker.cond.notify_all();
+}
+
+bool SegmentDecoder::push(Worker* worker, MediaFrame&& frame) {
+	{
+		std::unique_lock<std::mutex> lock(worker->mtx);
+		worker->cond.wait(lock, [this, worker] {
+			return stop_ || worker->frames.size() < capacity_;
+		});
+		if (stop_)
+			return false;
+		worker->frames.push_back(std::move(frame));
+	}
+	worker->cond.notify_all();
+	return true;
+}
+
+bool SegmentDecoder::read(MediaFrame* frame) {
+	while (!workers_.empty() && (loop_ || next_segment_ < segments_.size())) {
+		Worker& worker = *workers_[next_segment_ % workers_.size()];
+		MediaFrame next;
+		{
+			std::unique_lock<std::mutex> lock(worker.mtx);
+			if (worker.frames.empty() && !worker.finished && !stop_) {
+				// The reader caught up with the worker of this segment.
+				auto stall_start = std::chrono::steady_clock::now();
+				worker.cond.wait(lock, [this, &worker] {
+					return stop_ || worker.finished || !worker.frames.empty();
+				});
+				stalls_++;
+				stall_ms_ += milliseconds(std::chrono::steady_clock::now() -
+				                          stall_start).count();
+			}
+			// A worker only finishes early when it can't open the video.
+			if (stop_ || worker.frames.empty())
+				return false;
+			next = std::move(worker.frames.front());
+			worker.frames.pop_front();
+		}
+		worker.cond.notify_all();
+
+		if (next.image.empty()) {
+			next_segment_++;
+			continue;
+		}
+		// The decimation may have gone up since the worker decoded the frame.
+		int decimation = load_shedder_ ? load_shedder_->decimation() : 1;
+		if (decimation > 1 && (next.frame_number - 1) % decimation != 0) {
+			reader_decimated_++;
+			load_shedder_->on_frame_decimated();
+			continue;
+		}
+		*frame = std::move(next);
+		return true;
+	}
+	return false;
+}
+
+void SegmentDecoder::interrupt() {
+	stop_ = true;
+	for (const auto& worker : workers_) {
+		// Taking the lock orders stop_ before a waiter's predicate check.
+		{
+			std::lock_guard<std::mutex> lock(worker->mtx);
+		}
+		worker->cond.notify_all();
+	}
+}
+
+void SegmentDecoder::close() {
+	interrupt();
+	for (const auto& worker : workers_) {
+		if (worker->thread.joinable())
+			worker->thread.join();
+	}
+}
+
+void SegmentDecoder::print_report() const {
+	if (workers_.empty())
+		return;
+
+	std::cout << std::endl << "Segment-parallel decode:" << std::endl;
+	std::cout << "Workers:               " << workers_.size() << " with "
+	          << decode_threads_ << " decode threads each" << std::endl;
+	std::cout << "Segments:              " << segments_.size()
+	          << (keyframe_aligned_ ? " (split at keyframes, "
+	                                : " (fixed size, ")
+	          << split_segments_ << " split between keyframes, up to "
+	          << longest_segment_ << " frames, " << scan_ms_
+	          << " ms to plan)" << std::endl;
+	for (size_t i = 0; i < workers_.size(); ++i) {
+		const Worker& worker = *workers_[i];
+		std::cout << "Worker " << std::left << std::setw(15)
+		          << (std::to_string(i) + ":") << std::right
+		          << worker.decoded << " frames, "
+		          << (worker.decoded ? worker.decode_ms / worker.decoded : 0.0)
+		          << " ms per frame, " << worker.decimated << " decimated"
+		          << std::endl;
+	}
+	std::cout << "Reader stalls:         " << stalls_ << " (" << stall_ms_
+	          << " ms)" << std::endl;
+	std::cout << "Decimated by reader:   " << reader_decimated_ << std::endl;
+}
+
+bool run_ingest_benchmark(const std::string& path,
+                          int workers,
+                          int segment_frames,
+                          int decode_threads,
+                          cv::Size output) {
+	if (workers <= 1)
+		workers = (std::max)(2, static_cast<int>(std::thread::hardware_concurrency()));
+
+	cv::VideoCapture capture;
+	if (!open_video(&capture, path, decode_threads)) {
+		std::cerr << "Failed to open video file: " << path << std::endl;
+		return false;
+	}
+	double fps = capture.get(cv::CAP_PROP_FPS);
+	double frame_duration_ms = fps > 0 ? 1000.0 / fps : 1000.0 / 30.0;
+
+	std::cout << "Ingest benchmark: " << path << " (" << capture.getBackendName()
+	          << ", " << capture.get(cv::CAP_PROP_N_THREADS)
+	          << " decode threads per capture)" << std::endl;
+
+	// Every frame is hashed, so the parallel decode can be checked against
+	// the sequential one frame by frame. The sequential pass hashes on its
+	// decode thread, so the hash time is taken out of its timing.
+	struct Reference {
+		double   pts;
+		uint64_t hash;
+	};
+	std::vector<Reference> reference;
+	double hash_ms = 0.0;
+	auto start = std::chrono::steady_clock::now();
+	cv::Mat frame;
+	while (capture.read(frame)) {
+		double pts = capture.get(cv::CAP_PROP_POS_MSEC);
+		if (!(pts >= 0))
+			pts = reference.size() * frame_duration_ms;
+		cv::Mat image = fit_to_output(frame, output);
+		auto hash_start = std::chrono::steady_clock::now();
+		reference.push_back({pts, frame_hash(image)});
+		hash_ms += milliseconds(std::chrono::steady_clock::now() -
+		                        hash_start).count();
+	}
+	double sequential_s = (milliseconds(std::chrono::steady_clock::now() -
+	                                    start).count() - hash_ms) / 1000.0;
+	capture.release();
+
+	// The workers keep decoding while the reader would hash, so hashing
+	// can't be subtracted from the parallel time. The timed run only
+	// compares PTS, a second run compares the content.
+	auto run_parallel = [&](bool hash, SegmentDecoder* decoder,
+	                        uint64_t* frames, uint64_t* pts_mismatches,
+	                        uint64_t* content_mismatches) {
+		if (!decoder->open(path, workers, segment_frames, decode_threads,
+		                   output, frame_duration_ms, false))
+			return false;
+		MediaFrame decoded;
+		while (decoder->read(&decoded)) {
+			if (*frames < reference.size()) {
+				const Reference& expected = reference[*frames];
+				if (std::abs(decoded.pts - expected.pts) > kPtsToleranceMs)
+					(*pts_mismatches)++;
+				if (hash && frame_hash(decoded.image) != expected.hash)
+					(*content_mismatches)++;
+			}
+			(*frames)++;
+		}
+		decoder->close();
+		return true;
+	};
+
+	uint64_t parallel_frames = 0, pts_mismatches = 0, content_mismatches = 0;
+	SegmentDecoder decoder;
+	start = std::chrono::steady_clock::now();
+	if (!run_parallel(false, &decoder, &parallel_frames, &pts_mismatches,
+	                  &content_mismatches))
+		return false;
+	double parallel_s = milliseconds(std::chrono::steady_clock::now() -
+	                                 start).count() / 1000.0;
+
+	uint64_t checked_frames = 0, checked_pts_mismatches = 0;
+	SegmentDecoder checker;
+	if (!run_parallel(true, &checker, &checked_frames,
+	                  &checked_pts_mismatches, &content_mismatches))
+		return false;
+
+	uint64_t sequential_frames = reference.size();
+	std::cout << "Sequential:            " << sequential_frames << " frames in "
+	          << sequential_s << " s (" << sequential_frames / sequential_s
+	          << " fps)" << std::endl;
+	std::cout << "Segment-parallel:      " << parallel_frames << " frames in "
+	          << parallel_s << " s (" << parallel_frames / parallel_s
+	          << " fps), " << workers << " workers" << std::endl;
+	std::cout << "Speedup:               " << sequential_s / parallel_s
+	          << std::endl;
+	std::cout << "PTS mismatches:        " << pts_mismatches << std::endl;
+	std::cout << "Content mismatches:    " << content_mismatches
+	          << " (separate run, " << checked_frames << " frames)"
+	          << std::endl;
+	decoder.print_report();
+
+	return parallel_frames == sequential_frames &&
+		checked_frames == sequential_frames && pts_mismatches == 0 &&
+		checked_pts_mismatches == 0 && content_mismatches == 0;
+}
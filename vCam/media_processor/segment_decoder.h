@@ -0,0 +1,141 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+// segment_decoder.h
+
+#pragma once
+
+#ifndef SEGMENT_DECODER_H
+#define SEGMENT_DECODER_H
+
+#include <atomic>
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "load_shedder.h"  // NOLINT(build/include_subdir)
+#include "media_processor.h"  // NOLINT(build/include_subdir)
+
+// Open a video with the given number of backend frame/slice decode threads
+// (0: the backend's default).
+bool open_video(cv::VideoCapture* capture,
+                const std::string& path,
+                int decode_threads);
+
+// Segment-parallel video decoder.
+//
+// A demux-only pass finds the keyframes and the video is split at them
+// into segments of at least segment_frames frames. Each worker owns a
+// VideoCapture, seeks to the start of the segments assigned to it round
+// robin, decodes them and scales the frames to the output size into its
+// own bounded queue. read() takes the segments from the workers in order,
+// so frames come out in presentation order.
+//
+// A worker's queue holds the longest planned segment, so every worker can
+// decode a whole segment while the reader drains the ones before it.
+// Segments are capped at twice segment_frames: longer GOPs are split
+// between keyframes, at the cost of decoding from the preceding keyframe
+// after the seek. Memory is bounded by workers * max_queued_frames() output
+// frames.
+//
+// With a load shedder, the workers follow its decimation like
+// producer_video: frames that are shed are only grabbed, without the color
+// conversion, scaling and queueing. The workers run ahead of the reader by
+// up to workers * max_queued_frames() frames, so read() applies the current
+// decimation again and shedding takes effect immediately. Restoring quality
+// only reaches playback once the frames decoded ahead have been read.
+class SegmentDecoder {
+ public:
+	~SegmentDecoder() { close(); }
+
+	bool open(const std::string& path,
+	          int workers,
+	          int segment_frames,
+	          int decode_threads,
+	          cv::Size output,
+	          double frame_duration_ms,
+	          bool loop,
+	          LoadShedder* load_shedder = nullptr);
+	// Stop the workers and wait for them.
+	void close();
+	// Wake the reader and the workers, e.g. after stop was requested.
+	void interrupt();
+
+	// Upper bound of the frames buffered by one worker.
+	static int max_queued_frames(int segment_frames) {
+		return 2 * segment_frames + 1;
+	}
+
+	// Next frame in presentation order. frame_number counts from 1 within
+	// an iteration over the video. Returns false at the end of the video or
+	// after interrupt().
+	bool read(MediaFrame* frame);
+
+	void print_report() const;
+
+ private:
+	struct Segment {
+		int start;
+		// One past the last frame, INT_MAX for the last segment.
+		int end;
+	};
+
+	struct Worker {
+		std::thread             thread;
+		std::mutex              mtx;
+		std::condition_variable cond;
+		// Frames of the current segment, an empty image marks its end.
+		std::deque<MediaFrame>  frames;
+		bool                    finished = false;
+		uint64_t                decoded = 0;
+		uint64_t                decimated = 0;
+		double                  decode_ms = 0.0;
+	};
+
+	void plan_segments(int segment_frames);
+	void add_segment(int start, int end, int segment_frames);
+	void run_worker(size_t index);
+	bool push(Worker* worker, MediaFrame&& frame);
+
+	std::string  path_;
+	std::string  source_;
+	int          decode_threads_ = 0;
+	cv::Size     output_;
+	double       frame_duration_ms_ = 0.0;
+	bool         loop_ = false;
+	size_t       capacity_ = 0;
+	LoadShedder* load_shedder_ = nullptr;
+
+	std::vector<Segment>                 segments_;
+	bool                                 keyframe_aligned_ = false;
+	int                                  split_segments_ = 0;
+	int                                  longest_segment_ = 0;
+	double                               scan_ms_ = 0.0;
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::atomic<bool>                    stop_{false};
+
+	// Reader side: position in the endless sequence of segments over all
+	// iterations.
+	uint64_t next_segment_ = 0;
+	uint64_t stalls_ = 0;
+	double   stall_ms_ = 0.0;
+	uint64_t reader_decimated_ = 0;
+};
+
+// Decode a whole video once sequentially and once segment-parallel as fast
+// as possible and compare the frame rates. workers <= 1 uses one worker per
+// processor. Returns false if the parallel decode lost frames or any frame
+// differs from the sequential decode in PTS or content hash.
+bool run_ingest_benchmark(const std::string& path,
+                          int workers,
+                          int segment_frames,
+                          int decode_threads,
+                          cv::Size output);
+
+#endif  // SEGMENT_DECODER_H
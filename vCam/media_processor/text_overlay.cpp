@@ -0,0 +1,216 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+
+#include "text_overlay.h"  // NOLINT(build/include_subdir)
+
+#include <algorithm>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdio>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+
+#include <opencv2/imgproc.hpp>
+
+namespace {
+
+const int    kFont = cv::FONT_HERSHEY_PLAIN;
+const double kFontScale = 1.2;
+const int    kThickness = 1;
+const int    kPadding = 4;
+const int    kMargin = 8;
+
+// Frames stamped by the benchmark, 10 seconds at 60 fps.
+const int    kBenchmarkFrames = 600;
+
+using microseconds = std::chrono::duration<double, std::micro>;
+
+// Text of the two overlay lines.
+std::string position_line(const std::string& source, int frame_number,
+                          int iteration) {
+	return source + "  frame " + std::to_string(frame_number) +
+		"  iteration " + std::to_string(iteration);
+}
+
+}  // namespace
+
+void TextOverlay::init(int lines, int columns) {
+	// Size every cell for the widest glyph so the text is monospaced.
+	int baseline = 0;
+	cell_ = cv::Size(0, 0);
+	for (char c = kFirstGlyph; c <= kLastGlyph; ++c) {
+		cv::Size size = cv::getTextSize(std::string(1, c), kFont, kFontScale,
+		                                kThickness, &baseline);
+		cell_.width = (std::max)(cell_.width, size.width);
+		cell_.height = (std::max)(cell_.height, size.height + baseline);
+	}
+	cell_.width += 1;
+	cell_.height += kPadding;
+
+	int glyphs = kLastGlyph - kFirstGlyph + 1;
+	atlas_ = cv::Mat(cell_.height, cell_.width * glyphs, CV_8UC3,
+	                 cv::Scalar(0, 0, 0));
+	for (int i = 0; i < glyphs; ++i) {
+		cv::putText(atlas_, std::string(1, static_cast<char>(kFirstGlyph + i)),
+		            cv::Point(i * cell_.width, cell_.height - baseline - kPadding / 2),
+		            kFont, kFontScale, cv::Scalar(255, 255, 255), kThickness,
+		            cv::LINE_AA);
+	}
+
+	strip_ = cv::Mat(cell_.height * lines, cell_.width * columns, CV_8UC3,
+	                 cv::Scalar(0, 0, 0));
+	text_.assign(lines, std::string(columns, ' '));
+
+	frames_ = 0;
+	glyphs_updated_ = 0;
+	total_us_ = 0.0;
+	max_us_ = 0.0;
+	format_us_ = 0.0;
+}
+
+void TextOverlay::set_line(int line, const std::string& text) {
+	std::string& current = text_[line];
+	for (size_t i = 0; i < current.size(); ++i) {
+		char c = i < text.size() ? text[i] : ' ';
+		if (c < kFirstGlyph || c > kLastGlyph)
+			c = '?';
+		if (c == current[i])
+			continue;
+
+		current[i] = c;
+		cv::Rect glyph((c - kFirstGlyph) * cell_.width, 0,
+		               cell_.width, cell_.height);
+		cv::Rect cell(static_cast<int>(i) * cell_.width, line * cell_.height,
+		              cell_.width, cell_.height);
+		atlas_(glyph).copyTo(strip_(cell));
+		glyphs_updated_++;
+	}
+}
+
+void TextOverlay::draw(cv::Mat& frame) {  // NOLINT(runtime/references)
+	int width = (std::min)(strip_.cols, frame.cols - kMargin);
+	int height = (std::min)(strip_.rows, frame.rows - kMargin);
+	if (width > 0 && height > 0 && frame.type() == strip_.type()) {
+		// Opaque block: a plain row-wise copy, no per-pixel blending.
+		strip_(cv::Rect(0, 0, width, height)).copyTo(
+			frame(cv::Rect(kMargin, frame.rows - kMargin - height,
+			               width, height)));
+	}
+}
+
+void TextOverlay::stamp(cv::Mat& frame,  // NOLINT(runtime/references)
+                        const std::string& source, int frame_number,
+                        int iteration,
+                        std::chrono::system_clock::time_point present_time) {
+	auto start = std::chrono::steady_clock::now();
+
+	std::string position = position_line(source, frame_number, iteration);
+	std::string time = format_wall_clock(present_time);
+	auto formatted = std::chrono::steady_clock::now();
+
+	set_line(0, position);
+	set_line(1, time);
+	draw(frame);
+
+	auto end = std::chrono::steady_clock::now();
+	double us = microseconds(end - start).count();
+	format_us_ += microseconds(formatted - start).count();
+	total_us_ += us;
+	max_us_ = (std::max)(max_us_, us);
+	frames_++;
+}
+
+void TextOverlay::print_report() const {
+	if (frames_ == 0)
+		return;
+
+	std::cout << std::endl << "Overlay:" << std::endl;
+	std::cout << "Frames:                " << frames_ << std::endl;
+	std::cout << "Glyphs per frame:      "
+	          << static_cast<double>(glyphs_updated_) / frames_ << std::endl;
+	std::cout << "Time per frame (us):   avg " << total_us_ / frames_
+	          << " / max " << max_us_ << std::endl;
+	std::cout << "Formatting (us):       avg " << format_us_ / frames_
+	          << std::endl;
+}
+
+std::string format_wall_clock(std::chrono::system_clock::time_point time) {
+	std::time_t seconds = std::chrono::system_clock::to_time_t(time);
+	auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+		time.time_since_epoch()).count() % 1000;
+
+	std::tm local_time;
+	localtime_s(&local_time, &seconds);
+
+	char buffer[32];
+	size_t length = std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S",
+	                              &local_time);
+	snprintf(buffer + length, sizeof(buffer) - length, ".%03d",
+	         static_cast<int>(millis));
+	return buffer;
+}
+
+bool run_overlay_benchmark(cv::Size size) {
+	const std::string source = "benchmark.mp4";
+	const auto frame_interval = std::chrono::microseconds(16667);
+	if (size.width <= kMargin || size.height <= kMargin) {
+		std::cerr << "Frame too small for the overlay." << std::endl;
+		return false;
+	}
+	cv::Mat frame(size, CV_8UC3, cv::Scalar(64, 64, 64));
+
+	TextOverlay overlay;
+	overlay.init(2, 64);
+
+	std::cout << "Overlay benchmark: " << kBenchmarkFrames << " frames of "
+	          << size.width << "x" << size.height << ", text advancing at "
+	          << "60 fps." << std::endl;
+	std::cout << "Path          Avg (us)   Max (us)   % of 60 fps"
+	          << std::endl;
+
+	auto print = [](const char* name, double total_us, double max_us) {
+		double avg_us = total_us / kBenchmarkFrames;
+		std::cout << std::left << std::setw(12) << name << std::right
+		          << std::fixed << std::setprecision(1)
+		          << std::setw(10) << avg_us << std::setw(11) << max_us
+		          << std::setprecision(2)
+		          << std::setw(14) << 100.0 * avg_us / (1e6 / 60)
+		          << std::endl;
+		std::cout.unsetf(std::ios::floatfield);
+		std::cout << std::setprecision(6);
+	};
+
+	// The consumer path: format, recomposite changed glyphs, copy the strip.
+	auto time = std::chrono::system_clock::now();
+	double total_us = 0.0, max_us = 0.0;
+	for (int i = 0; i < kBenchmarkFrames; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		overlay.stamp(frame, source, i + 1, 1, time + i * frame_interval);
+		double us = microseconds(std::chrono::steady_clock::now() - start)
+			.count();
+		total_us += us;
+		max_us = (std::max)(max_us, us);
+	}
+	print("Atlas", total_us, max_us);
+
+	// Rasterizing the same text with cv::putText every frame, for reference.
+	total_us = 0.0;
+	max_us = 0.0;
+	for (int i = 0; i < kBenchmarkFrames; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		int y = frame.rows - kMargin;
+		cv::putText(frame, format_wall_clock(time + i * frame_interval),
+		            cv::Point(kMargin, y), kFont, kFontScale,
+		            cv::Scalar(255, 255, 255), kThickness, cv::LINE_AA);
+		cv::putText(frame, position_line(source, i + 1, 1),
+		            cv::Point(kMargin, y - 20), kFont, kFontScale,
+		            cv::Scalar(255, 255, 255), kThickness, cv::LINE_AA);
+		double us = microseconds(std::chrono::steady_clock::now() - start)
+			.count();
+		total_us += us;
+		max_us = (std::max)(max_us, us);
+	}
+	print("cv::putText", total_us, max_us);
+
+	overlay.print_report();
+	return true;
+}
@@ -0,0 +1,69 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+// text_overlay.h
+
+#pragma once
+
+#ifndef TEXT_OVERLAY_H
+#define TEXT_OVERLAY_H
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// Burns a few lines of fixed-width text into the output frames.
+//
+// cv::putText rasterizes every glyph on every call, which is far too slow at
+// 60 fps. Instead the printable ASCII glyphs are rendered once into an atlas,
+// the text block is kept in an opaque strip where only the characters that
+// changed since the previous frame are recomposited from the atlas, and the
+// strip is copied into each frame row by row.
+class TextOverlay {
+ public:
+	// Render the atlas and reserve a strip of lines x columns characters.
+	void init(int lines, int columns);
+	bool initialized() const { return !strip_.empty(); }
+
+	// Replace the text of a line; characters that didn't change are kept.
+	void set_line(int line, const std::string& text);
+
+	// Copy the text strip into the bottom-left corner of a BGR frame.
+	void draw(cv::Mat& frame);  // NOLINT(runtime/references)
+
+	// Write the source, frame number, iteration and presentation time into
+	// the two lines of the overlay and draw it into the frame. Formatting the
+	// text is timed together with the compositing.
+	void stamp(cv::Mat& frame,  // NOLINT(runtime/references)
+	           const std::string& source, int frame_number, int iteration,
+	           std::chrono::system_clock::time_point present_time);
+
+	// Per-frame cost of stamp(), accumulated since init().
+	void print_report() const;
+
+ private:
+	static constexpr char kFirstGlyph = ' ';
+	static constexpr char kLastGlyph = '~';
+
+	cv::Mat atlas_;
+	cv::Mat strip_;
+	cv::Size cell_;
+	std::vector<std::string> text_;
+
+	uint64_t frames_ = 0;
+	uint64_t glyphs_updated_ = 0;
+	double   total_us_ = 0.0;
+	double   max_us_ = 0.0;
+	double   format_us_ = 0.0;
+};
+
+// Format a wall-clock time as "YYYY-MM-DD HH:MM:SS.mmm".
+std::string format_wall_clock(std::chrono::system_clock::time_point time);
+
+// Stamp frames of the given size as playback at 60 fps would, and print the
+// per-frame cost of the overlay next to cv::putText. Returns false if the
+// overlay can't be drawn.
+bool run_overlay_benchmark(cv::Size size);
+
+#endif  // TEXT_OVERLAY_H
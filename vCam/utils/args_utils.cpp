@@ -4,23 +4,64 @@
 
 #include <iostream>
 #include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+// Parse a region given as "x,y,width,height"
+static cv::Rect parse_rect(const std::string& text) {
+    std::istringstream stream(text);
+    int x, y, width, height;
+    char c1, c2, c3;
+    if (!(stream >> x >> c1 >> y >> c2 >> width >> c3 >> height) ||
+        c1 != ',' || c2 != ',' || c3 != ',' || width <= 0 || height <= 0)
+        throw std::invalid_argument(text);
+    return cv::Rect(x, y, width, height);
+}
 
 bool parseArguments(int argc, char* argv[],
                     std::string& media_type,  // NOLINT(runtime/references)
                     std::string& media_path,  // NOLINT(runtime/references)
                     bool& loop,  // NOLINT(runtime/references)
-                    bool& cv_log) {  // NOLINT(runtime/references)
-    if (argc < 3 || argc > 5) {
+                    bool& cv_log,  // NOLINT(runtime/references)
+                    MediaOptions& options) {  // NOLINT(runtime/references)
+    // --filter-bench and --overlay-bench run on a synthetic frame and take
+    // no media path.
+    media_type = argc >= 2 ? argv[1] : "";
+    if (argc < 3 && media_type != "--filter-bench" &&
+        media_type != "--overlay-bench") {
         print_usage(argv[0]);
         return false;
     }
 
-    media_type = argv[1];
-    media_path = argv[2];
+    media_path = argc >= 3 ? argv[2] : "";
 
-    // Check if loop argument is provided
-    if (argc >= 4) {
+    int next_arg = 3;
+
+    if (media_type == "--filter-bench") {
+        // Only the filter switches matter: --filter-bench [filter options]
+        options.filter_benchmark = true;
+        media_path.clear();
+        next_arg = 2;
+        loop = false;
+    } else if (media_type == "--overlay-bench") {
+        options.overlay_benchmark = true;
+        media_path.clear();
+        next_arg = 2;
+        loop = false;
+    } else if (media_type == "--verify") {
+        // Offline comparison of two recordings: --verify <golden> <run>
+        if (argc < 4) {
+            print_usage(argv[0]);
+            return false;
+        }
+        options.verify_path = argv[2];
+        options.record_path = argv[3];
+        next_arg = 4;
+        loop = false;
+    } else if (argc >= 4 && argv[3][0] != '-') {
+        // Loop argument is provided
         std::string loop_arg = argv[3];
+        next_arg = 4;
         // Define a lambda function to convert characters to lowercase
         auto toLower = [](unsigned char c) {
             return std::tolower(c);
@@ -49,20 +90,137 @@ bool parseArguments(int argc, char* argv[],
 
     cv_log = false;
 
-    for (int i = 1; i < argc; ++i) {
+    // Optional switches, some of them followed by a value
+    for (int i = next_arg; i < argc; ++i) {
         std::string arg = argv[i];
-        if (arg == "-d") {
-            cv_log = true;
-            break;
+        // Consume the value following the current switch
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+                throw std::invalid_argument(arg);
+            return argv[++i];
+        };
+
+        try {
+            if (arg == "-d") {
+                cv_log = true;
+            } else if (arg == "--overlay") {
+                options.overlay = true;
+            } else if (arg == "--producer-affinity") {
+                options.producer_thread.affinity_mask =
+                    std::stoull(value(), nullptr, 0);
+            } else if (arg == "--consumer-affinity") {
+                options.consumer_thread.affinity_mask =
+                    std::stoull(value(), nullptr, 0);
+            } else if (arg == "--producer-priority") {
+                if (!parse_thread_priority(value(),
+                                           &options.producer_thread.priority))
+                    throw std::invalid_argument(arg);
+            } else if (arg == "--consumer-priority") {
+                if (!parse_thread_priority(value(),
+                                           &options.consumer_thread.priority))
+                    throw std::invalid_argument(arg);
+            } else if (arg == "--producer-mmcss") {
+                options.producer_thread.mmcss_task = value();
+            } else if (arg == "--consumer-mmcss") {
+                options.consumer_thread.mmcss_task = value();
+            } else if (arg == "--priority-class") {
+                if (!parse_priority_class(value(), &options.priority_class))
+                    throw std::invalid_argument(arg);
+            } else if (arg == "--lock-memory") {
+                options.locked_memory_mb = std::stoul(value());
+            } else if (arg == "--stress") {
+                options.stress_threads = std::stoi(value());
+            } else if (arg == "--no-frame-pool") {
+                options.frame_pool = false;
+            } else if (arg == "--soak") {
+                options.soak_minutes = std::stoi(value());
+            } else if (arg == "--brightness") {
+                options.brightness = std::stod(value());
+            } else if (arg == "--contrast") {
+                options.contrast = std::stod(value());
+            } else if (arg == "--gamma") {
+                options.gamma = std::stod(value());
+                if (options.gamma <= 0)
+                    throw std::invalid_argument(arg);
+            } else if (arg == "--chroma-key") {
+                options.chroma_key_background = value();
+            } else if (arg == "--blur") {
+                options.blur_region = parse_rect(value());
+            } else if (arg == "--blur-kernel") {
+                options.blur_kernel = std::stoi(value());
+            } else if (arg == "--decoder") {
+                if (!parse_decoder_backend(value(), &options.decoder))
+                    throw std::invalid_argument(arg);
+            } else if (arg == "--decoder-bench") {
+                options.decoder_benchmark = true;
+            } else if (arg == "--decode-threads") {
+                options.decode_threads = std::stoi(value());
+            } else if (arg == "--decode-workers") {
+                options.decode_workers = std::stoi(value());
+                if (options.decode_workers < 1)
+                    throw std::invalid_argument(arg);
+            } else if (arg == "--segment-frames") {
+                options.segment_frames = std::stoi(value());
+                if (options.segment_frames < 1)
+                    throw std::invalid_argument(arg);
+            } else if (arg == "--ingest-bench") {
+                options.ingest_benchmark = true;
+            } else if (arg == "--idle-when-unwatched") {
+                options.idle_when_unwatched = true;
+            } else if (arg == "--record") {
+                options.record_path = value();
+            } else if (arg == "--verify") {
+                options.verify_path = value();
+            } else if (arg == "--timing-tolerance") {
+                options.timing_tolerance_ms = std::stod(value());
+            } else if (arg == "--probe") {
+                options.probe_camera = std::stoi(value());
+            } else if (arg == "--probe-budget") {
+                options.probe_budget_ms = std::stod(value());
+            } else {
+                std::cerr << "Invalid argument: " << arg << std::endl;
+                print_usage(argv[0]);
+                return false;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Missing or invalid value for " << arg << "."
+                << std::endl;
+            print_usage(argv[0]);
+            return false;
         }
     }
 
+    if (options.decoder_benchmark && media_type != "-i") {
+        std::cerr << "--decoder-bench needs an image directory (-i)."
+            << std::endl;
+        print_usage(argv[0]);
+        return false;
+    }
+
+    if (options.ingest_benchmark && media_type != "-v") {
+        std::cerr << "--ingest-bench needs a video file (-v)." << std::endl;
+        print_usage(argv[0]);
+        return false;
+    }
+
+    if (!options.verify_path.empty() && options.record_path.empty()) {
+        std::cerr << "--verify needs a recording of the run, "
+            << "add --record <file>." << std::endl;
+        print_usage(argv[0]);
+        return false;
+    }
+
     return true;
 }
 
 void print_usage(const char* programName) {
     std::cerr << "Usage: " << programName << " <-v/-i> <media_path> "
-        << "[loop: 0 or 1] [-d]" << std::endl;
+        << "[loop: 0 or 1] [-d] [options]" << std::endl;
+    std::cerr << "       " << programName << " --verify <golden_recording> "
+        << "<recording> [--timing-tolerance <ms>]" << std::endl;
+    std::cerr << "       " << programName << " --filter-bench "
+        << "[filter options]" << std::endl;
+    std::cerr << "       " << programName << " --overlay-bench" << std::endl;
     std::cerr << "Arguments:" << std::endl;
     std::cerr << "  -v:           Specify video input." << std::endl;
     std::cerr << "  -i:           Specify image input." << std::endl;
@@ -71,7 +229,87 @@ void print_usage(const char* programName) {
     std::cerr << "  <loop>:       Whether to loop indefinitely. "
         << "0 for false, 1 for true." << std::endl;
     std::cerr << "  -d:           Enable detailed logging." << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --overlay:              Burn file name, frame number, "
+        << "iteration and time into frames." << std::endl;
+    std::cerr << "  --overlay-bench:        Time the overlay on a synthetic "
+        << "1920x1080 frame and exit." << std::endl;
+    std::cerr << "  --producer-affinity <mask>, --consumer-affinity <mask>:"
+        << std::endl;
+    std::cerr << "                          Restrict a pipeline thread to the "
+        << "processors in <mask>." << std::endl;
+    std::cerr << "  --producer-priority <p>, --consumer-priority <p>:"
+        << std::endl;
+    std::cerr << "                          Thread priority: idle, lowest, "
+        << "below_normal, normal," << std::endl;
+    std::cerr << "                          above_normal, highest or "
+        << "time_critical." << std::endl;
+    std::cerr << "  --producer-mmcss <task>, --consumer-mmcss <task>:"
+        << std::endl;
+    std::cerr << "                          Register a pipeline thread with "
+        << "MMCSS, e.g. \"Playback\"." << std::endl;
+    std::cerr << "  --priority-class <c>:   Process priority class: idle, "
+        << "below_normal, normal," << std::endl;
+    std::cerr << "                          above_normal, high or realtime."
+        << std::endl;
+    std::cerr << "  --lock-memory <MB>:     Raise the minimum working set to "
+        << "<MB> and lock the frame" << std::endl;
+    std::cerr << "                          pool into memory." << std::endl;
+    std::cerr << "  --stress <threads>:     Run busy threads to measure pacing "
+        << "under CPU contention." << std::endl;
+    std::cerr << "  --no-frame-pool:        Allocate frames from the heap "
+        << "instead of the frame pool." << std::endl;
+    std::cerr << "  --soak <minutes>:       Stop after <minutes>, reporting the "
+        << "working set every minute." << std::endl;
+    std::cerr << "  --brightness <offset>, --contrast <factor>, --gamma <g>:"
+        << std::endl;
+    std::cerr << "                          Adjust the colors of every frame."
+        << std::endl;
+    std::cerr << "  --chroma-key <image>:   Replace green screen with the given "
+        << "background image." << std::endl;
+    std::cerr << "  --blur <x,y,w,h>:       Blur a region, e.g. for privacy."
+        << std::endl;
+    std::cerr << "  --blur-kernel <size>:   Blur kernel size in pixels "
+        << "(default 31)." << std::endl;
+    std::cerr << "  --filter-bench:         Time each filter on a synthetic "
+        << "1920x1080 frame and exit." << std::endl;
+    std::cerr << "  --decoder <backend>:    Image decoder: auto, opencv, "
+        << "turbojpeg or stb." << std::endl;
+    std::cerr << "  --decoder-bench:        Compare the image decoders on "
+        << "<media_path> and exit." << std::endl;
+    std::cerr << "  --decode-threads <n>:   Frame/slice threads of the video "
+        << "decoder." << std::endl;
+    std::cerr << "  --decode-workers <n>:   Decode video segments on <n> "
+        << "cores in parallel." << std::endl;
+    std::cerr << "  --segment-frames <n>:   Minimum frames per segment "
+        << "(default 32)." << std::endl;
+    std::cerr << "  --ingest-bench:         Compare sequential and parallel "
+        << "decode of <media_path>." << std::endl;
+    std::cerr << "  --idle-when-unwatched:  Stop decoding while no "
+        << "application has the camera open" << std::endl;
+    std::cerr << "                          (needs a driver that exports "
+        << "GetConsumerCount)." << std::endl;
+    std::cerr << "  --record <file>:        Record a content hash and the "
+        << "scheduled and actual" << std::endl;
+    std::cerr << "                          present time of every frame."
+        << std::endl;
+    std::cerr << "  --verify <golden>:      Compare the recording with a golden "
+        << "one on exit." << std::endl;
+    std::cerr << "  --timing-tolerance <ms>: Allowed deviation of frame "
+        << "intervals (default 5)." << std::endl;
+    std::cerr << "  --probe <camera_index>: Stamp a latency marker into every "
+        << "frame and read it back" << std::endl;
+    std::cerr << "                          from the given camera to measure "
+        << "end-to-end latency." << std::endl;
+    std::cerr << "  --probe-budget <ms>:    Fail when the 99th percentile "
+        << "latency exceeds <ms>." << std::endl;
     std::cerr << "\nExample:" << std::endl;
     std::cerr << "  vVam.exe -v /path/to/video/video.mp4" << std::endl;
     std::cerr << "  vVam.exe -i /path/to/image" << std::endl;
+    std::cerr << "  vVam.exe -v /path/to/video/video.mp4 1 --probe 0" << std::endl;
+    std::cerr << "  vVam.exe --verify golden.rec run.rec" << std::endl;
+    std::cerr << "  vVam.exe --filter-bench --blur-kernel 51" << std::endl;
+    std::cerr << "  vVam.exe -i /path/to/image --decoder-bench" << std::endl;
+    std::cerr << "  vVam.exe -v /path/to/video/4k.mp4 1 --decode-workers 4"
+        << std::endl;
 }
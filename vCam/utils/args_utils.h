@@ -8,12 +8,15 @@
 
 #include <string>
 
+#include "../media_processor/media_processor.h"
+
 // Function to parse command line arguments
 bool parseArguments(int argc, char* argv[],  // NOLINT(runtime/references)
                     std::string& media_type,  // NOLINT(runtime/references)
                     std::string& media_path,  // NOLINT(runtime/references)
                     bool& loop,  // NOLINT(runtime/references)
-                    bool& cv_log);  // NOLINT(runtime/references)
+                    bool& cv_log,  // NOLINT(runtime/references)
+                    MediaOptions& options);  // NOLINT(runtime/references)
 
 // Function to print usage information
 void print_usage(const char* programName);
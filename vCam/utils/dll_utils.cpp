@@ -4,10 +4,13 @@
 
 #include <windows.h>
 
+#include <fstream>
 #include <iostream>
-#include <regex>  // NOLINT(build/c++11)
 #include <string>
 
+#include "file_utils.h"   // NOLINT(build/include_subdir)
+#include "timing_utils.h"   // NOLINT(build/include_subdir)
+
 // Define function pointers and HINSTANCE variable
 InitFunc Init;
 FreeFunc Free;
@@ -16,24 +19,67 @@ GetDevicePathFunc GetDevicePath;
 DestroyDeviceFunc DestroyDevice;
 SetDeviceFunc SetDevice;
 SetBufferFunc SetBuffer;
+GetConsumerCountFunc GetConsumerCount;
 
 HINSTANCE hDll;
 
-// Function to extract the device identifier
+// Function to extract the device identifier. Matches the same text as the
+// pattern "@device:pnp:\\.*root.*unknown.*global" without compiling a
+// std::regex for every device.
 std::string ExtractDeviceIdentifier(const std::string& devicePath) {
-	// Define the modified regex pattern to match the device identifier
-	std::regex pattern("@device:pnp:\\\\.*root.*unknown.*global");
-
-	// Match using the regex pattern
-	std::smatch match;
-	if (std::regex_search(devicePath, match, pattern)) {
-		if (match.size() > 0) {
-			// Return the first matched group as the device identifier
-			return match.str(0);
-		}
-	}
-	// Return an empty string if no matching device identifier is found
-	return "";
+	const std::string prefix = "@device:pnp:\\";
+
+	size_t start = devicePath.find(prefix);
+	if (start == std::string::npos)
+		return "";
+
+	size_t root = devicePath.find("root", start + prefix.size());
+	if (root == std::string::npos)
+		return "";
+
+	size_t unknown = devicePath.find("unknown", root + 4);
+	if (unknown == std::string::npos)
+		return "";
+
+	// Greedy match: the identifier extends to the last "global"
+	size_t global = devicePath.rfind("global");
+	if (global == std::string::npos || global < unknown + 7)
+		return "";
+
+	return devicePath.substr(start, global + 6 - start);
+}
+
+// The vCam device path found by the last run, so the next start can skip
+// enumerating every capture device.
+static std::string device_cache_path() {
+	return GetExecutablePath() + "\\vCam_device.cache";
+}
+
+static std::string load_cached_device_path() {
+	std::ifstream cache(device_cache_path());
+	std::string devicePath;
+	std::getline(cache, devicePath);
+	return devicePath;
+}
+
+static void save_cached_device_path(const std::string& devicePath) {
+	std::ofstream cache(device_cache_path(), std::ios::trunc);
+	cache << devicePath << std::endl;
+}
+
+// Unload the DLL and forget its entry points, so free_dll() after a failed
+// init_dll() has nothing left to call.
+static void unload_dll() {
+	FreeLibrary(hDll);
+	hDll = NULL;
+	Init = nullptr;
+	Free = nullptr;
+	GetNumDevices = nullptr;
+	GetDevicePath = nullptr;
+	DestroyDevice = nullptr;
+	SetDevice = nullptr;
+	SetBuffer = nullptr;
+	GetConsumerCount = nullptr;
 }
 
 bool init_dll() {
@@ -101,26 +147,46 @@ bool init_dll() {
 		std::cerr << "Failed to get SetBufferFunc address." << std::endl;
 	}
 
+	// Not exported by the current driver; --idle-when-unwatched needs a driver
+	// that reports its consumers.
+	GetConsumerCount = reinterpret_cast<GetConsumerCountFunc>
+		(GetProcAddress(hDll, "GetConsumerCount"));
+
 	if (!Init || !Free || !GetNumDevices || !GetDevicePath ||
 		!DestroyDevice || !SetDevice || !SetBuffer) {
 		std::cerr << "Failed to get function pointers" << std::endl;
-		FreeLibrary(hDll);
+		unload_dll();
 		return false;
 	}
 
 	// Initialize the DLL
 	if (!Init()) {
 		std::cerr << "Failed to initialize DLL" << std::endl;
-		FreeLibrary(hDll);
+		unload_dll();
 		return false;
 	}
+	mark_startup_phase("Driver interface loaded");
+
+	// Try the device that matched last time before enumerating all of them
+	std::string cachedPath = load_cached_device_path();
+	if (!cachedPath.empty() && cachedPath.size() < 256) {
+		char devicePath[256];
+		strncpy_s(devicePath, sizeof(devicePath), cachedPath.c_str(),
+		          _TRUNCATE);
+		if (SetDevice(devicePath, static_cast<int>(strlen(devicePath)))) {
+			std::cout << std::endl << "1. Using cached vCam device: "
+			          << ExtractDeviceIdentifier(cachedPath) << std::endl;
+			mark_startup_phase("Device set (cached)");
+			return true;
+		}
+	}
 
 	// Get the number of devices
 	int numDevices = GetNumDevices();
 	if (numDevices <= 0) {
 		std::cerr << "Failed to get number of devices" << std::endl;
 		Free();
-		FreeLibrary(hDll);
+		unload_dll();
 		return false;
 	}
 
@@ -165,9 +231,11 @@ bool init_dll() {
 			if (!SetDevice(devicePath, static_cast<int>(strlen(devicePath)))) {
 				std::cerr << "Failed to set device" << std::endl;
 				Free();
-				FreeLibrary(hDll);
+				unload_dll();
 				return false;
 			}
+			save_cached_device_path(devicePath);
+			mark_startup_phase("Device set (enumerated)");
 			break;
 		} else {
 			std::cout << "Ignore device identifier for device at index "
@@ -179,8 +247,8 @@ bool init_dll() {
 
 void free_dll() {
     if (hDll != NULL) {
-        Free();
-        FreeLibrary(hDll);
-        hDll = NULL;
+        if (Free != nullptr)
+            Free();
+        unload_dll();
     }
 }
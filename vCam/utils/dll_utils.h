@@ -16,6 +16,7 @@ typedef int  (*GetDevicePathFunc)(int, char*, int);
 typedef void (*DestroyDeviceFunc)();
 typedef int  (*SetDeviceFunc)(char*, int);
 typedef int  (*SetBufferFunc)(void*, DWORD, DWORD, DWORD);
+typedef int  (*GetConsumerCountFunc)();
 
 // Declare function pointers as extern
 extern InitFunc Init;
@@ -25,6 +26,9 @@ extern GetDevicePathFunc GetDevicePath;
 extern DestroyDeviceFunc DestroyDevice;
 extern SetDeviceFunc SetDevice;
 extern SetBufferFunc SetBuffer;
+// Number of applications that have the virtual camera open. Optional, null
+// when the driver interface doesn't export it.
+extern GetConsumerCountFunc GetConsumerCount;
 
 // Function declarations
 bool init_dll();
@@ -0,0 +1,194 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+
+#include "thread_utils.h"   // NOLINT(build/include_subdir)
+
+#include <windows.h>
+#include <avrt.h>
+
+#include <atomic>
+#include <iostream>
+#include <mutex>  // NOLINT(build/c++11)
+#include <sstream>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#pragma comment(lib, "avrt.lib")
+
+namespace {
+
+const std::pair<const char*, int> kThreadPriorities[] = {
+    {"idle",          THREAD_PRIORITY_IDLE},
+    {"lowest",        THREAD_PRIORITY_LOWEST},
+    {"below_normal",  THREAD_PRIORITY_BELOW_NORMAL},
+    {"normal",        THREAD_PRIORITY_NORMAL},
+    {"above_normal",  THREAD_PRIORITY_ABOVE_NORMAL},
+    {"highest",       THREAD_PRIORITY_HIGHEST},
+    {"time_critical", THREAD_PRIORITY_TIME_CRITICAL},
+};
+
+const std::pair<const char*, uint32_t> kPriorityClasses[] = {
+    {"idle",          IDLE_PRIORITY_CLASS},
+    {"below_normal",  BELOW_NORMAL_PRIORITY_CLASS},
+    {"normal",        NORMAL_PRIORITY_CLASS},
+    {"above_normal",  ABOVE_NORMAL_PRIORITY_CLASS},
+    {"high",          HIGH_PRIORITY_CLASS},
+    {"realtime",      REALTIME_PRIORITY_CLASS},
+};
+
+std::mutex report_mtx;
+std::vector<std::string> report_lines;
+
+std::atomic<bool> stress_stop(false);
+std::vector<std::thread> stress_threads;
+
+void add_report_line(const std::string& line) {
+    std::lock_guard<std::mutex> lock(report_mtx);
+    report_lines.push_back(line);
+}
+
+std::string thread_priority_name(int priority) {
+    for (const auto& entry : kThreadPriorities) {
+        if (entry.second == priority)
+            return entry.first;
+    }
+    return std::to_string(priority);
+}
+
+std::string priority_class_name(uint32_t priority_class) {
+    for (const auto& entry : kPriorityClasses) {
+        if (entry.second == priority_class)
+            return entry.first;
+    }
+    return std::to_string(priority_class);
+}
+
+}  // namespace
+
+ScopedThreadConfig::ScopedThreadConfig(const std::string& stage,
+                                       const ThreadConfig& config) {
+    HANDLE thread = GetCurrentThread();
+    std::ostringstream errors;
+
+    if (config.affinity_mask != 0 &&
+        !SetThreadAffinityMask(thread,
+                               static_cast<DWORD_PTR>(config.affinity_mask))) {
+        errors << " [affinity 0x" << std::hex << config.affinity_mask
+               << std::dec << " failed, error " << GetLastError() << "]";
+    }
+
+    if (config.priority != kDefaultThreadPriority &&
+        !SetThreadPriority(thread, config.priority)) {
+        errors << " [priority " << thread_priority_name(config.priority)
+               << " failed, error " << GetLastError() << "]";
+    }
+
+    // MMCSS raises the thread into the real-time range for as long as it is
+    // registered, without needing a real-time process priority class.
+    if (!config.mmcss_task.empty()) {
+        DWORD task_index = 0;
+        mmcss_handle_ = AvSetMmThreadCharacteristicsA(config.mmcss_task.c_str(),
+                                                      &task_index);
+        if (mmcss_handle_ == NULL) {
+            errors << " [MMCSS \"" << config.mmcss_task << "\" failed, error "
+                   << GetLastError() << "]";
+        }
+    }
+
+    // Report what the OS actually applied
+    GROUP_AFFINITY affinity = {};
+    GetThreadGroupAffinity(thread, &affinity);
+
+    std::ostringstream line;
+    line << stage << ": affinity 0x" << std::hex
+         << static_cast<uint64_t>(affinity.Mask) << std::dec
+         << ", priority " << thread_priority_name(GetThreadPriority(thread))
+         << ", MMCSS "
+         << (mmcss_handle_ != NULL ? "\"" + config.mmcss_task + "\"" : "none")
+         << errors.str();
+    add_report_line(line.str());
+}
+
+ScopedThreadConfig::~ScopedThreadConfig() {
+    if (mmcss_handle_ != NULL)
+        AvRevertMmThreadCharacteristics(mmcss_handle_);
+}
+
+void apply_process_config(uint32_t priority_class, size_t locked_memory_mb) {
+    HANDLE process = GetCurrentProcess();
+    std::ostringstream errors;
+
+    // REALTIME_PRIORITY_CLASS silently degrades to HIGH without the
+    // SeIncreaseBasePriorityPrivilege, hence the report below.
+    if (priority_class != 0 && !SetPriorityClass(process, priority_class)) {
+        errors << " [priority class " << priority_class_name(priority_class)
+               << " failed, error " << GetLastError() << "]";
+    }
+
+    // Raising the minimum working set is only a hint to the memory manager,
+    // pages above it can still be trimmed. It does raise the quota of pages
+    // VirtualLock can pin, which the frame pool uses to lock its slab.
+    if (locked_memory_mb != 0) {
+        SIZE_T minimum = static_cast<SIZE_T>(locked_memory_mb) << 20;
+        if (!SetProcessWorkingSetSize(process, minimum, minimum * 2)) {
+            errors << " [working set " << locked_memory_mb
+                   << " MB failed, error " << GetLastError() << "]";
+        }
+    }
+
+    std::ostringstream line;
+    line << "process: priority class "
+         << priority_class_name(GetPriorityClass(process));
+    if (locked_memory_mb != 0)
+        line << ", minimum working set " << locked_memory_mb << " MB";
+    line << errors.str();
+    add_report_line(line.str());
+}
+
+bool parse_thread_priority(const std::string& name, int* priority) {
+    for (const auto& entry : kThreadPriorities) {
+        if (name == entry.first) {
+            *priority = entry.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parse_priority_class(const std::string& name, uint32_t* priority_class) {
+    for (const auto& entry : kPriorityClasses) {
+        if (name == entry.first) {
+            *priority_class = entry.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+void print_thread_report() {
+    std::lock_guard<std::mutex> lock(report_mtx);
+    if (report_lines.empty())
+        return;
+
+    std::cout << std::endl << "Thread placement:" << std::endl;
+    for (const std::string& line : report_lines)
+        std::cout << "  " << line << std::endl;
+}
+
+void start_cpu_stress(int threads) {
+    stress_stop = false;
+    for (int i = 0; i < threads; ++i) {
+        stress_threads.emplace_back([]() {
+            volatile uint64_t counter = 0;
+            while (!stress_stop)
+                counter = counter + 1;
+        });
+    }
+}
+
+void stop_cpu_stress() {
+    stress_stop = true;
+    for (std::thread& thread : stress_threads)
+        thread.join();
+    stress_threads.clear();
+}
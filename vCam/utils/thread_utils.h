@@ -0,0 +1,54 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+// thread_utils.h
+
+#pragma once
+
+#ifndef THREAD_UTILS_HPP
+#define THREAD_UTILS_HPP
+
+#include <cstdint>
+#include <string>
+
+// Leave the scheduler's default in place.
+const int kDefaultThreadPriority = 0x7fff;
+
+// Placement and scheduling of one pipeline thread.
+struct ThreadConfig {
+	// Processors the thread may run on, 0 for no restriction.
+	uint64_t    affinity_mask = 0;
+	// One of the THREAD_PRIORITY_* values or kDefaultThreadPriority.
+	int         priority = kDefaultThreadPriority;
+	// MMCSS task to register the thread with, e.g. "Playback" or "Pro Audio".
+	std::string mmcss_task;
+};
+
+// Applies a ThreadConfig to the calling thread for the lifetime of the object
+// and records what the OS actually granted for print_thread_report().
+class ScopedThreadConfig {
+ public:
+	ScopedThreadConfig(const std::string& stage, const ThreadConfig& config);
+	~ScopedThreadConfig();
+
+	ScopedThreadConfig(const ScopedThreadConfig&) = delete;
+	ScopedThreadConfig& operator=(const ScopedThreadConfig&) = delete;
+
+ private:
+	void* mmcss_handle_ = nullptr;
+};
+
+// Process wide settings: priority class (0 to keep it) and minimum working set
+// in MB so pipeline memory isn't paged out (0 to keep it).
+void apply_process_config(uint32_t priority_class, size_t locked_memory_mb);
+
+// Parse names such as "highest" or "high" into the Win32 values.
+bool parse_thread_priority(const std::string& name, int* priority);
+bool parse_priority_class(const std::string& name, uint32_t* priority_class);
+
+// Print what was requested and applied for the process and every thread.
+void print_thread_report();
+
+// Busy threads competing for the CPU, to measure pacing under contention.
+void start_cpu_stress(int threads);
+void stop_cpu_stress();
+
+#endif  // THREAD_UTILS_HPP
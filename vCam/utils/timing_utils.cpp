@@ -0,0 +1,41 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+
+#include "timing_utils.h"   // NOLINT(build/include_subdir)
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <iomanip>
+#include <iostream>
+#include <mutex>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Captured during static initialization, i.e. right before main() runs.
+const auto process_start = std::chrono::steady_clock::now();
+
+std::mutex phases_mtx;
+std::vector<std::pair<std::string, double>> phases;
+
+}  // namespace
+
+void mark_startup_phase(const std::string& phase) {
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - process_start;
+
+    std::lock_guard<std::mutex> lock(phases_mtx);
+    phases.emplace_back(phase, elapsed.count());
+}
+
+void print_startup_report() {
+    std::lock_guard<std::mutex> lock(phases_mtx);
+    if (phases.empty())
+        return;
+
+    std::cout << std::endl << "Startup:" << std::endl;
+    for (const auto& phase : phases) {
+        std::cout << "  " << std::left << std::setw(32) << phase.first
+                  << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(9) << phase.second << " ms" << std::endl;
+    }
+}
@@ -0,0 +1,18 @@
+﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
+// timing_utils.h
+
+#pragma once
+
+#ifndef TIMING_UTILS_HPP
+#define TIMING_UTILS_HPP
+
+#include <string>
+
+// Record that a startup phase completed, with the time since process start.
+// Safe to call from any thread.
+void mark_startup_phase(const std::string& phase);
+
+// Print the recorded phases in the order they completed.
+void print_startup_report();
+
+#endif  // TIMING_UTILS_HPP
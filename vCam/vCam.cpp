@@ -1,30 +1,70 @@
 ﻿/* Copyright(c), 2024, linuslau (liukezhao@gmail.com) */
 
+#include <future>  // NOLINT(build/c++11)
 #include <iostream>
 
 #include "utils/args_utils.h"
 #include "utils/file_utils.h"
 #include "utils/dll_utils.h"
+#include "utils/timing_utils.h"
+#include "media_processor/filter_chain.h"
+#include "media_processor/frame_recorder.h"
 #include "media_processor/media_processor.h"
+#include "media_processor/segment_decoder.h"
+#include "media_processor/text_overlay.h"
 
 int main(int argc, char* argv[]) {
 	std::cout << "Hello, KZ vCam Test App. \n";
 
 	std::string media_type, media_path;
 	bool loop = false, cv_log = false;
+	MediaOptions options;
 
-	if (!parseArguments(argc, argv, media_type, media_path, loop, cv_log)) {
+	if (!parseArguments(argc, argv, media_type, media_path, loop, cv_log,
+	                    options)) {
 		std::system("pause");
 		return 1;
 	}
 
-	init_dll();
+	// Compare two recordings without touching the driver.
+	if (media_type == "--verify")
+		return verify_recording(options.verify_path, options.record_path,
+		                        options.timing_tolerance_ms) ? 0 : 1;
 
-	if (!start_media_processing(media_type, media_path, loop, cv_log))
-		return 1;
+	// Compare the image decoders without touching the driver.
+	if (options.decoder_benchmark)
+		return run_decoder_benchmark(media_path, cv::Size(1280, 720)) ? 0 : 1;
+
+	// Compare sequential and segment-parallel video decoding.
+	if (options.ingest_benchmark)
+		return run_ingest_benchmark(media_path, options.decode_workers,
+		                            options.segment_frames,
+		                            options.decode_threads,
+		                            cv::Size(1280, 720)) ? 0 : 1;
+
+	// Time the filters on a synthetic frame without touching the driver.
+	if (options.filter_benchmark)
+		return run_filter_benchmark(options, cv::Size(1920, 1080)) ? 0 : 1;
+
+	// Time the text overlay on a synthetic frame without touching the driver.
+	if (options.overlay_benchmark)
+		return run_overlay_benchmark(cv::Size(1920, 1080)) ? 0 : 1;
+
+	mark_startup_phase("Arguments parsed");
+
+	// Bring the driver up while the media is opened and the first frame is
+	// decoded; the consumer waits for it before presenting.
+	std::shared_future<bool> sink_ready =
+		std::async(std::launch::async, init_dll).share();
+
+	int processed = start_media_processing(media_type, media_path, loop,
+	                                       cv_log, options, sink_ready);
 
+	// Processing can fail before anything waited for the driver; let init_dll
+	// finish before the DLL is unloaded.
+	sink_ready.wait();
 	free_dll();
 
-	return 0;
+	return processed ? 0 : 1;
 }
 